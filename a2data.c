@@ -1,4 +1,4 @@
-/* 
+/*
  * Assignment 2 data structure implementation
  * Handles conversion and memory management for address data
  */
@@ -7,24 +7,52 @@
 #include <assert.h>
 #include "a2data.h"
 
-/* Convert CSV record to a2_data structure */
-a2_data *a2_from_csvRecord(struct csvRecord *rec){
-    a2_data *d = malloc(sizeof(a2_data));
+/* Allocate a record with room for textBytes of field text after it */
+static a2_data *a2_alloc(size_t textBytes, char **text){
+    a2_data *d = malloc(sizeof(a2_data) + textBytes);
     assert(d);
-    
+    *text = (char *) (d + 1);
+    return d;
+}
+
+/* Convert the fields of a mapped CSV row to an a2_data structure */
+a2_data *a2_from_csvFields(struct csvReader *reader, struct csvField *fields,
+                           int fieldCount){
+    assert(fieldCount == A2_NUM_FIELDS);
+    // Decoding never lengthens a field, so the raw lengths are enough
+    size_t textBytes = 0;
     for(int i = 0; i < A2_NUM_FIELDS; i++){
-        d->fields[i] = strdup(rec->fields[i]);
-        assert(d->fields[i]);
+        textBytes += fields[i].length + 1;
+    }
+
+    char *text;
+    a2_data *d = a2_alloc(textBytes, &text);
+    for(int i = 0; i < A2_NUM_FIELDS; i++){
+        d->fields[i] = text;
+        d->lengths[i] = csvFieldDecode(reader, &fields[i], text);
+        text += d->lengths[i] + 1;
     }
     return d;
 }
 
-/* Free a2_data structure and all associated memory */
-void a2_free(a2_data *d){
-    if(!d) return;
-    
+/* Decode the raw text of a row into a single allocation */
+a2_data *a2_from_row(const char *row, size_t length){
+    struct csvField fields[A2_NUM_FIELDS];
+    int fieldCount = csvSplitRow(row, length, fields, A2_NUM_FIELDS);
+    assert(fieldCount == A2_NUM_FIELDS);
+
+    // The row plus a terminator for each field is enough
+    char *text;
+    a2_data *d = a2_alloc(length + A2_NUM_FIELDS, &text);
     for(int i = 0; i < A2_NUM_FIELDS; i++){
-        free(d->fields[i]);
+        d->fields[i] = text;
+        d->lengths[i] = csvSliceDecode(row, &fields[i], text);
+        text += d->lengths[i] + 1;
     }
+    return d;
+}
+
+/* Free a2_data structure and all associated memory */
+void a2_free(a2_data *d){
     free(d);
 }
@@ -1,42 +1,55 @@
-/* 
+/*
  * Assignment 2 Data Structure Header
- * 
- * This header defines the data structure used to store address records
- * for the Patricia Trie dictionary implementation. It provides a simplified
- * interface for handling CSV records with exactly 35 fields.
+ *
+ * This header defines the structure used to hold a single decoded address
+ * row, with exactly 35 fields, on its way into a record store (or out of a
+ * lazy one). It provides a simplified interface for handling CSV records.
  */
 
 #ifndef A2DATA_H
 #define A2DATA_H
 
-#include "record_struct.h"
+#include <stddef.h>
+#include "read.h"
 
 /* Number of fields in each address record */
 #define A2_NUM_FIELDS 35
 
-/* 
+/* Index of the field records are keyed on (EZI_ADD) */
+#define A2_KEY_FIELD 1
+
+/*
  * Structure to hold a single address record
  * Contains all 35 fields from the CSV data as string pointers
  * Fields 0-32 contain various address components
  * Fields 33-34 contain x,y coordinates as strings
+ * The field text is stored in the same allocation as the structure
  */
 typedef struct a2_data {
-    char *fields[A2_NUM_FIELDS]; // Array of string pointers for all 35 fields
+    char *fields[A2_NUM_FIELDS];          // Array of string pointers for all 35 fields
+    unsigned int lengths[A2_NUM_FIELDS];  // Length of each field, so it never needs strlen
 } a2_data;
 
-/* 
- * Convert a generic CSV record to an a2_data structure
- * Allocates memory for the a2_data structure and copies all field strings
+/*
+ * Build an a2_data structure directly from the fields of a mapped CSV row
+ * Each field is decoded straight out of the reader's data with a single copy
+ * Safe to call from multiple threads at once
  * Returns: pointer to newly allocated a2_data structure
  */
-a2_data *a2_from_csvRecord(struct csvRecord *rec);
+a2_data *a2_from_csvFields(struct csvReader *reader, struct csvField *fields,
+                           int fieldCount);
 
-/* 
+/*
+ * Build an a2_data structure from the raw text of a single CSV row of
+ * length bytes, splitting and decoding its fields
+ * Returns: pointer to newly allocated a2_data structure
+ */
+a2_data *a2_from_row(const char *row, size_t length);
+
+/*
  * Free an a2_data structure and all associated memory
- * Frees all field strings and the structure itself
  * Safe to call with NULL pointer
  */
 void a2_free(a2_data *d);
 
 #endif
-
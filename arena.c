@@ -0,0 +1,199 @@
+/*
+    Data structure and function implementations for a bump allocator.
+*/
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <sys/mman.h>
+
+#define BLOCK_BYTES (1 << 20)
+#define ARENA_ALIGN 16
+
+struct arena;
+
+/* Add the usage of from to a's. */
+static void arenaAddUsage(struct arena *a, struct arena *from);
+
+#ifdef ARENA_MALLOC
+
+/* Allocations are passed on to malloc, only their usage is kept. */
+struct arena {
+    struct arenaUsage usage;
+};
+
+struct arena *newArena(){
+    struct arena *a = calloc(1, sizeof(struct arena));
+    assert(a);
+    return a;
+}
+
+void *arenaAlloc(struct arena *a, size_t size){
+    void *p = malloc(size);
+    assert(p || size == 0);
+    a->usage.allocations++;
+    a->usage.bytes += size;
+    return p;
+}
+
+void *arenaCalloc(struct arena *a, size_t size){
+    void *p = calloc(1, size);
+    assert(p || size == 0);
+    a->usage.allocations++;
+    a->usage.bytes += size;
+    return p;
+}
+
+void *arenaRealloc(struct arena *a, void *p, size_t oldSize, size_t newSize){
+    p = realloc(p, newSize);
+    assert(p || newSize == 0);
+    a->usage.allocations++;
+    a->usage.bytes += newSize;
+    return p;
+}
+
+void arenaFree(struct arena *a, void *p){
+    free(p);
+}
+
+void freeArena(struct arena *a){
+    free(a);
+}
+
+void arenaAdopt(struct arena *a, struct arena *from){
+    arenaAddUsage(a, from);
+    free(from);
+}
+
+#else
+
+/* A mapped block, allocations follow the header. */
+struct arenaBlock {
+    struct arenaBlock *next;
+    size_t size;                 // Bytes mapped, including the header
+} __attribute__((aligned(ARENA_ALIGN)));
+
+struct arena {
+    struct arenaBlock *blocks;   // Most recently mapped first
+    char *next;                  // Free space in the current block
+    char *end;
+    char *last;                  // Latest allocation, which can grow in place
+    struct arenaUsage usage;
+};
+
+/* Round n up to the alignment of every allocation */
+static size_t alignSize(size_t n){
+    return (n + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+}
+
+/* Map a block with room for at least size bytes after its header */
+static struct arenaBlock *mapBlock(size_t size){
+    size_t bytes = sizeof(struct arenaBlock) + size;
+    if(bytes < BLOCK_BYTES){
+        bytes = BLOCK_BYTES;
+    }
+    struct arenaBlock *b = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(b != MAP_FAILED);
+    b->size = bytes;
+    return b;
+}
+
+struct arena *newArena(){
+    struct arena *a = calloc(1, sizeof(struct arena));
+    assert(a);
+    return a;
+}
+
+void *arenaAlloc(struct arena *a, size_t size){
+    size = alignSize(size);
+    a->usage.allocations++;
+    a->usage.bytes += size;
+    if(size > (size_t) (a->end - a->next)){
+        struct arenaBlock *b = mapBlock(size);
+        a->usage.blocks++;
+        a->usage.mapped += b->size;
+        if(size > BLOCK_BYTES / 4 && a->blocks){
+            /* Too big to be worth starting over for, give it a block of its
+                own behind the current one. */
+            b->next = a->blocks->next;
+            a->blocks->next = b;
+            return (char *) (b + 1);
+        }
+        b->next = a->blocks;
+        a->blocks = b;
+        a->next = (char *) (b + 1);
+        a->end = (char *) b + b->size;
+    }
+    a->last = a->next;
+    a->next += size;
+    return a->last;
+}
+
+void *arenaCalloc(struct arena *a, size_t size){
+    /* Fresh mappings are already zero, but reused space isn't. */
+    void *p = arenaAlloc(a, size);
+    memset(p, 0, size);
+    return p;
+}
+
+void *arenaRealloc(struct arena *a, void *p, size_t oldSize, size_t newSize){
+    if(p && p == a->last && alignSize(newSize) <= (size_t) (a->end - a->last)){
+        a->usage.bytes -= (size_t) (a->next - a->last);
+        a->usage.bytes += alignSize(newSize);
+        a->next = a->last + alignSize(newSize);
+        return p;
+    }
+    void *q = arenaAlloc(a, newSize);
+    if(oldSize > 0){
+        memcpy(q, p, oldSize < newSize ? oldSize : newSize);
+    }
+    return q;
+}
+
+void arenaFree(struct arena *a, void *p){
+}
+
+void arenaAdopt(struct arena *a, struct arena *from){
+    /* Its blocks go behind the current one, which keeps its free space. */
+    struct arenaBlock **tail = &from->blocks;
+    while(*tail){
+        tail = &(*tail)->next;
+    }
+    if(a->blocks){
+        *tail = a->blocks->next;
+        a->blocks->next = from->blocks;
+    } else {
+        *tail = NULL;
+        a->blocks = from->blocks;
+    }
+    arenaAddUsage(a, from);
+    free(from);
+}
+
+void freeArena(struct arena *a){
+    if(! a){
+        return;
+    }
+    struct arenaBlock *b = a->blocks;
+    while(b){
+        struct arenaBlock *next = b->next;
+        munmap(b, b->size);
+        b = next;
+    }
+    free(a);
+}
+
+#endif
+
+void arenaUsage(struct arena *a, struct arenaUsage *u){
+    *u = a->usage;
+}
+
+static void arenaAddUsage(struct arena *a, struct arena *from){
+    a->usage.allocations += from->usage.allocations;
+    a->usage.bytes += from->usage.bytes;
+    a->usage.blocks += from->usage.blocks;
+    a->usage.mapped += from->usage.mapped;
+}
@@ -0,0 +1,64 @@
+/*
+    Data structure declarations and prototypes for a bump allocator. An arena
+    hands out memory from large mapped blocks, and everything allocated from
+    it is released at once by freeArena, a munmap per block, instead of one
+    free per allocation.
+
+    Built with ARENA_MALLOC defined, every allocation is a plain malloc 
+    instead and arenaFree frees it, so the two modes can be compared. Owners
+    free each allocation themselves only when ARENA_BULK_FREE is 0.
+
+    An arena must only be used by one thread at a time.
+*/
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#ifdef ARENA_MALLOC
+#define ARENA_BULK_FREE 0
+#else
+#define ARENA_BULK_FREE 1
+#endif
+
+/* Bump allocator. */
+struct arena;
+
+/* What an arena has handed out since it was created. */
+struct arenaUsage {
+    size_t allocations;
+    size_t bytes;           // Bytes asked for, after alignment
+    size_t blocks;          // Blocks mapped, 0 with ARENA_MALLOC
+    size_t mapped;          // Bytes mapped, 0 with ARENA_MALLOC
+};
+
+/* Returns an empty arena. */
+struct arena *newArena();
+
+/* Returns size bytes of memory, aligned for any type. */
+void *arenaAlloc(struct arena *a, size_t size);
+
+/* Returns size bytes of zeroed memory, aligned for any type. */
+void *arenaCalloc(struct arena *a, size_t size);
+
+/* Returns a copy of the oldSize bytes at p resized to newSize bytes. p may be
+    NULL if oldSize is 0. */
+void *arenaRealloc(struct arena *a, void *p, size_t oldSize, size_t newSize);
+
+/* Release a single allocation. Does nothing unless built with ARENA_MALLOC,
+    the memory is reclaimed with the arena. */
+void arenaFree(struct arena *a, void *p);
+
+/* Move everything allocated from the arena from into a, and free from. The
+    allocations stay where they are, now released with a. */
+void arenaAdopt(struct arena *a, struct arena *from);
+
+/* Fill in u with the arena's usage so far. Memory released by arenaFree is
+    still counted. */
+void arenaUsage(struct arena *a, struct arenaUsage *u);
+
+/* Free the arena and, unless built with ARENA_MALLOC, everything allocated
+    from it. */
+void freeArena(struct arena *a);
+
+#endif
@@ -0,0 +1,321 @@
+/*
+ * Crit-bit Trie implementation
+ * A bitwise Patricia trie, see critbit.h
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "critbit.h"
+#include "editdist.h"
+#include "bit.h"
+
+#define INIT_NODES 64
+
+/* Returns the given bit of a key keyLen bytes long, keys read as 0 past their end */
+static int key_bit(const char *key, size_t keyLen, uint32_t bit){
+    size_t byte = bit / BITS_PER_BYTE;
+    if(byte >= keyLen) return 0;
+    return ((unsigned char)key[byte] >> (BITS_PER_BYTE - 1 - bit % BITS_PER_BYTE)) & 1;
+}
+
+/*
+ * Find the first bit in which two keys differ, returns false if they don't
+ * Neither key holds a '\0', so keys of different lengths always differ
+ */
+static bool first_diff(const char *a, size_t a_len, const char *b, size_t b_len,
+                       uint32_t *bit){
+    size_t i = pt_common_prefix(a, b, a_len < b_len ? a_len : b_len);
+    if(i == a_len && i == b_len) return false;
+    unsigned char ca = i < a_len ? (unsigned char)a[i] : 0;
+    unsigned char cb = i < b_len ? (unsigned char)b[i] : 0;
+    unsigned char diff = ca ^ cb;
+    uint32_t pos = 0;
+    while(!(diff & (0x80 >> pos))) pos++;
+    *bit = (uint32_t)i * BITS_PER_BYTE + pos;
+    return true;
+}
+
+/* Returns the key of a leaf */
+static const char *leaf_key(const cbtree_t *t, const cb_leaf_t *l){
+    return t->key(t->key_ud, l->key_rec);
+}
+
+/* Create a new internal node, reusing a freed one if there is one */
+static cb_handle_t internal_new(cbtree_t *t){
+    cb_handle_t h = t->free_internal;
+    if(h != CB_NONE){
+        t->free_internal = t->internals[h].child[0];
+        return h;
+    }
+    if(t->internal_count == t->internal_space){
+        t->internal_space *= 2;
+        assert(t->internal_space < CB_LEAF);
+        t->internals = realloc(t->internals, sizeof(cb_internal_t) * t->internal_space);
+        assert(t->internals);
+    }
+    return t->internal_count++;
+}
+
+/* Put an internal node back on the free list */
+static void internal_release(cbtree_t *t, cb_handle_t h){
+    t->internals[h].child[0] = t->free_internal;
+    t->free_internal = h;
+}
+
+/* Create a new leaf for a key keyLen bytes long holding rec */
+static cb_handle_t leaf_new(cbtree_t *t, recordId rec, size_t keyLen){
+    uint32_t i = t->free_leaf;
+    if(i != CB_NONE){
+        t->free_leaf = t->leaves[i].key_rec;
+    } else {
+        if(t->leaf_count == t->leaf_space){
+            t->leaf_space *= 2;
+            assert(t->leaf_space < CB_LEAF);
+            t->leaves = realloc(t->leaves, sizeof(cb_leaf_t) * t->leaf_space);
+            assert(t->leaves);
+        }
+        i = t->leaf_count++;
+    }
+    cb_leaf_t *l = &t->leaves[i];
+    memset(l, 0, sizeof(*l));
+    l->key_rec = rec;
+    l->key_len = (uint32_t)keyLen;
+    pt_records_push(t->arena, &l->records, rec);
+    return i | CB_LEAF;
+}
+
+/* Put a leaf back on the free list, along with any spilled record ids */
+static void leaf_release(cbtree_t *t, cb_handle_t h){
+    cb_leaf_t *l = cb_leaf(t, h);
+    if(l->records.space) arenaFree(t->arena, l->records.ids);
+    l->records.space = 0;
+    l->key_rec = t->free_leaf;
+    t->free_leaf = h & ~CB_LEAF;
+}
+
+/* Create a new empty crit-bit trie */
+cbtree_t *cb_create(pt_key_fn key, void *key_ud){
+    cbtree_t *t = calloc(1, sizeof(*t));
+    assert(t);
+    t->root = CB_NONE;
+    t->internal_space = INIT_NODES;
+    t->internals = malloc(sizeof(cb_internal_t) * t->internal_space);
+    assert(t->internals);
+    t->free_internal = CB_NONE;
+    t->leaf_space = INIT_NODES;
+    t->leaves = malloc(sizeof(cb_leaf_t) * t->leaf_space);
+    assert(t->leaves);
+    t->free_leaf = CB_NONE;
+    t->arena = newArena();
+    t->key = key;
+    t->key_ud = key_ud;
+    return t;
+}
+
+/* Free the trie, the spilled record ids go with its arena */
+void cb_free(cbtree_t *t){
+    if(!t) return;
+    // Unless the arena was built to use malloc, it takes every spilled array with it
+    if(!ARENA_BULK_FREE){
+        for(uint32_t i = 0; i < t->leaf_count; i++)
+            if(t->leaves[i].records.space) arenaFree(t->arena, t->leaves[i].records.ids);
+    }
+    freeArena(t->arena);
+    free(t->internals);
+    free(t->leaves);
+    free(t);
+}
+
+/* Insert a key-record pair into the crit-bit trie */
+void cb_insert(cbtree_t *t, const char *key, size_t keyLen, recordId rec){
+    if(t->root == CB_NONE){
+        t->root = leaf_new(t, rec, keyLen);
+        return;
+    }
+
+    // Follow the key's bits down to the leaf sharing the most of them
+    cb_handle_t h = t->root;
+    while(!(h & CB_LEAF)){
+        const cb_internal_t *n = &t->internals[h];
+        h = n->child[key_bit(key, keyLen, n->bit)];
+    }
+    cb_leaf_t *l = cb_leaf(t, h);
+    uint32_t bit;
+    if(!first_diff(key, keyLen, leaf_key(t, l), l->key_len, &bit)){
+        // Key already present - add the record to its list
+        pt_records_push(t->arena, &l->records, rec);
+        return;
+    }
+
+    // The new internal node goes above the first node on the key's path
+    // with a later critical bit
+    int dir = key_bit(key, keyLen, bit);
+    cb_handle_t leaf = leaf_new(t, rec, keyLen);
+    cb_handle_t n = internal_new(t);
+    cb_handle_t *where = &t->root;
+    while(!(*where & CB_LEAF) && t->internals[*where].bit < bit){
+        cb_internal_t *p = &t->internals[*where];
+        where = &p->child[key_bit(key, keyLen, p->bit)];
+    }
+    t->internals[n].bit = bit;
+    t->internals[n].child[dir] = leaf;
+    t->internals[n].child[1 - dir] = *where;
+    *where = n;
+}
+
+/* Remove a record from the list of the given key */
+bool cb_remove_record(cbtree_t *t, const char *key, recordId rec){
+    if(t->root == CB_NONE) return false;
+    size_t keyLen = strlen(key);
+
+    // Follow the key down to its leaf, without touching the metrics
+    cb_handle_t *where = &t->root;
+    cb_handle_t *parent_where = NULL;
+    int dir = 0;
+    while(!(*where & CB_LEAF)){
+        parent_where = where;
+        cb_internal_t *p = &t->internals[*where];
+        dir = key_bit(key, keyLen, p->bit);
+        where = &p->child[dir];
+    }
+    cb_leaf_t *l = cb_leaf(t, *where);
+    if(l->key_len != keyLen || memcmp(leaf_key(t, l), key, keyLen) != 0) return false;
+    if(!pt_records_remove(&l->records, rec)) return false;
+    if(l->records.count > 0) return true;
+
+    // The key is gone, its sibling takes the parent's place
+    leaf_release(t, *where);
+    if(!parent_where){
+        t->root = CB_NONE;
+        return true;
+    }
+    cb_handle_t parent = *parent_where;
+    *parent_where = t->internals[parent].child[1 - dir];
+    internal_release(t, parent);
+    return true;
+}
+
+/*
+ * Search for a key in the crit-bit trie, tracking where mismatch occurs
+ * Returns the mismatch subtree, or the key's leaf and sets exact if found
+ */
+cb_handle_t cb_search_with_mismatch(cbtree_t *t, const char *key, bool *exact,
+                                    size_t *key_start){
+    if(exact) *exact = false;
+    if(key_start) *key_start = 0;
+    g_metrics.nodeCount = 0ULL;
+    if(t->root == CB_NONE) return CB_NONE;
+    size_t keyLen = strlen(key);
+
+    cb_handle_t h = t->root;
+    while(!(h & CB_LEAF)){
+        g_metrics.nodeCount++;  // Count each node visit
+        g_metrics.bitCount++;   // and the critical bit tested there
+        const cb_internal_t *n = &t->internals[h];
+        h = n->child[key_bit(key, keyLen, n->bit)];
+    }
+    g_metrics.nodeCount++;
+
+    // The only full key comparison
+    const cb_leaf_t *l = cb_leaf(t, h);
+    int lcp = pt_lcp_bits(key, keyLen, leaf_key(t, l), l->key_len);
+    if((size_t)lcp == keyLen && lcp == (int)l->key_len){
+        if(exact) *exact = true;
+        return h;
+    }
+
+    // No key shares more characters with the query than the leaf's does, and
+    // those which share as many lie under the first node on the query's path
+    // testing a bit past them. The nodes on the way were counted above
+    uint32_t limit = (uint32_t)lcp * BITS_PER_BYTE;
+    h = t->root;
+    while(!(h & CB_LEAF) && t->internals[h].bit < limit){
+        const cb_internal_t *n = &t->internals[h];
+        // Keys branching off here share this many characters with the query,
+        // the trie's node for the subtree would have its label start there
+        if(key_start) *key_start = n->bit / BITS_PER_BYTE;
+        h = n->child[key_bit(key, keyLen, n->bit)];
+    }
+    return h;
+}
+
+/* State of a similarity search */
+typedef struct {
+    const char *query;
+    int query_len;
+    size_t key_start;
+    int best_dist;
+    const cb_leaf_t *best;
+} cb_sim_t;
+
+/*
+ * Visit every leaf under h, which are reached in key order, so the first of
+ * equally distant keys found is the lexicographically smallest
+ */
+static void similar_visit(const cbtree_t *t, cb_handle_t h, cb_sim_t *sim){
+    g_metrics.nodeCount++;
+    if(h & CB_LEAF){
+        const cb_leaf_t *l = cb_leaf(t, h);
+        g_metrics.stringCount++;  // Count each string comparison
+        int d = editDistance((char*)sim->query, (char*)leaf_key(t, l) + sim->key_start,
+                             sim->query_len, (int)(l->key_len - sim->key_start));
+        if(!sim->best || d < sim->best_dist){
+            sim->best = l;
+            sim->best_dist = d;
+        }
+        return;
+    }
+    const cb_internal_t *n = &t->internals[h];
+    similar_visit(t, n->child[0], sim);
+    similar_visit(t, n->child[1], sim);
+}
+
+/* Find the most similar key under node using edit distance */
+const record_vec_t *cb_search_similar_under(cbtree_t *t, cb_handle_t node,
+                                            size_t key_start, const char *query,
+                                            char **best_key_out){
+    if(best_key_out) *best_key_out = NULL;
+    if(node == CB_NONE) return NULL;
+
+    cb_sim_t sim = {0};
+    sim.query = query;
+    sim.query_len = (int)strlen(query);
+    sim.key_start = key_start;
+    sim.best_dist = 0x3f3f3f3f;  // Large initial distance
+    similar_visit(t, node, &sim);
+
+    if(best_key_out){
+        *best_key_out = strndup(leaf_key(t, sim.best) + key_start,
+                                sim.best->key_len - key_start);
+        assert(*best_key_out);
+    }
+    return &sim.best->records;
+}
+
+/* Accumulate the statistics of the subtree under h, depth internal nodes down */
+static void subtree_stats(const cbtree_t *t, cb_handle_t h, uint64_t depth,
+                          cb_memory_stats_t *stats){
+    if(h & CB_LEAF){
+        const cb_leaf_t *l = cb_leaf(t, h);
+        stats->leaves++;
+        if(depth > stats->max_depth) stats->max_depth = depth;
+        stats->records += l->records.count;
+        if(!l->records.space) stats->inline_records += l->records.count;
+        return;
+    }
+    stats->internals++;
+    subtree_stats(t, t->internals[h].child[0], depth + 1, stats);
+    subtree_stats(t, t->internals[h].child[1], depth + 1, stats);
+}
+
+/* Fill in stats with the memory held by the trie */
+void cb_memory_stats(const cbtree_t *t, cb_memory_stats_t *stats){
+    memset(stats, 0, sizeof(*stats));
+    if(t->root != CB_NONE) subtree_stats(t, t->root, 0, stats);
+    stats->internal_bytes = sizeof(cb_internal_t) * (uint64_t)t->internal_space;
+    stats->leaf_bytes = sizeof(cb_leaf_t) * (uint64_t)t->leaf_space;
+    stats->unused = sizeof(cb_internal_t) * (t->internal_space - stats->internals)
+                  + sizeof(cb_leaf_t) * (t->leaf_space - stats->leaves);
+    arenaUsage(t->arena, &stats->arena);
+}
@@ -0,0 +1,130 @@
+/*
+ * Crit-bit Trie Header
+ *
+ * A bitwise Patricia trie over the same keys and records as patricia.h. Each
+ * internal node holds only the index of the first bit in which the keys
+ * below it differ, its critical bit, and its two children; each leaf holds
+ * one key and its records. A search tests one bit per internal node and
+ * compares the whole key only once, at the leaf it ends at.
+ *
+ * Bits are numbered from the highest order bit of the first character, as
+ * getBit does, and keys read as 0 past their end.
+ *
+ * Comparisons are counted in g_metrics in the same terms as the trie:
+ *   bitCount    1 for each critical bit tested, then the key compared with
+ *               the leaf's as pt_lcp_bits counts it
+ *   nodeCount   each internal node and leaf visited
+ *   stringCount each key the query's edit distance is found to
+ */
+
+#ifndef CRITBIT_H
+#define CRITBIT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "patricia.h"
+
+/* Handle of a node, leaves have CB_LEAF set and the rest is an index */
+typedef uint32_t cb_handle_t;
+
+/* Handle bit set for leaves */
+#define CB_LEAF 0x80000000u
+
+/* Handle standing for no node */
+#define CB_NONE UINT32_MAX
+
+/* Internal node, with the leaves whose critical bit is 0 down child[0] */
+typedef struct cb_internal {
+    cb_handle_t child[2];
+    uint32_t bit;               // Critical bit, smaller than any below it
+} cb_internal_t;
+
+/* Leaf, a key and its records */
+typedef struct cb_leaf {
+    recordId key_rec;           // Record whose key this is
+    uint32_t key_len;
+    record_vec_t records;       // Records associated with this key
+} cb_leaf_t;
+
+/*
+ * Crit-bit trie structure
+ * Internal nodes and leaves are kept in two arrays and refer to each other
+ * by handle, freed entries are linked through child[0] and key_rec
+ */
+typedef struct cbtree {
+    cb_handle_t root;           // CB_NONE while empty
+    cb_internal_t *internals;
+    uint32_t internal_count;    // Entries used, including freed ones
+    uint32_t internal_space;
+    uint32_t free_internal;
+    cb_leaf_t *leaves;
+    uint32_t leaf_count;
+    uint32_t leaf_space;
+    uint32_t free_leaf;
+    struct arena *arena;        // Spilled record ids
+    pt_key_fn key;              // Where the keys are held
+    void *key_ud;
+} cbtree_t;
+
+/* Returns the leaf a leaf handle refers to */
+static inline cb_leaf_t *cb_leaf(const cbtree_t *t, cb_handle_t h){
+    return &t->leaves[h & ~CB_LEAF];
+}
+
+/* Create a new empty crit-bit trie over records whose keys key returns */
+cbtree_t *cb_create(pt_key_fn key, void *key_ud);
+
+/* Free the crit-bit trie and all associated memory, but not the records */
+void cb_free(cbtree_t *t);
+
+/*
+ * Insert a record under its key, keyLen bytes long
+ * key must be the text key returns for the record
+ */
+void cb_insert(cbtree_t *t, const char *key, size_t keyLen, recordId rec);
+
+/*
+ * Remove a record from the list of the given key, returns true if it was there
+ * Once the key has no records left its leaf and parent are removed
+ */
+bool cb_remove_record(cbtree_t *t, const char *key, recordId rec);
+
+/*
+ * Search for a key, returning the top of the subtree holding every key
+ * which shares the most leading characters with it
+ * Sets *exact to true if that is the key's own leaf, returns CB_NONE if the
+ * trie is empty. Sets *key_start to where the label of the subtree's node
+ * would start in the character trie, which is where pt_search_similar_under
+ * compares keys from
+ */
+cb_handle_t cb_search_with_mismatch(cbtree_t *t, const char *key, bool *exact,
+                                    size_t *key_start);
+
+/*
+ * Find the most similar key under node using edit distance, in the same way
+ * as pt_search_similar_under, and return its records
+ * Keys are compared from key_start characters in, as returned by
+ * cb_search_with_mismatch
+ * If best_key_out is not NULL, stores a copy of the best matching key from there
+ */
+const record_vec_t *cb_search_similar_under(cbtree_t *t, cb_handle_t node,
+                                            size_t key_start, const char *query,
+                                            char **best_key_out);
+
+/* Memory held by a crit-bit trie, in bytes unless noted */
+typedef struct cb_memory_stats {
+    uint64_t internals;         // Internal nodes in the trie
+    uint64_t leaves;            // Leaves in the trie
+    uint64_t max_depth;         // Most internal nodes above any leaf
+    uint64_t internal_bytes;
+    uint64_t leaf_bytes;
+    uint64_t unused;            // Freed and spare entries of both arrays
+    uint64_t records;           // Record ids held
+    uint64_t inline_records;    // Of which held inline in the leaf
+    struct arenaUsage arena;    // Spilled record ids
+} cb_memory_stats_t;
+
+/* Fill in stats with the memory held by the trie */
+void cb_memory_stats(const cbtree_t *t, cb_memory_stats_t *stats);
+
+#endif
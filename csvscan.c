@@ -0,0 +1,120 @@
+/*
+ * CSV structural scanner implementation
+ * Classifies commas, quotes and line feeds 64 bytes at a time
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "csvscan.h"
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define CSVSCAN_X86 1
+#include <immintrin.h>
+#endif
+
+/* Scanner in use, chosen once at startup */
+static void (*scanImpl)(const char *p, struct csvMasks *masks);
+
+/* Portable fallback, classifies one byte at a time */
+static void scanScalar(const char *p, struct csvMasks *masks){
+    uint64_t comma = 0, quote = 0, newline = 0;
+    for(int i = 0; i < CSVSCAN_BLOCK; i++){
+        uint64_t bit = 1ULL << i;
+        switch(p[i]){
+            case ',':
+                comma |= bit;
+                break;
+            case '\"':
+                quote |= bit;
+                break;
+            case '\n':
+                newline |= bit;
+                break;
+        }
+    }
+    masks->comma = comma;
+    masks->quote = quote;
+    masks->newline = newline;
+}
+
+#ifdef CSVSCAN_X86
+/* Compare 16 bytes against c and return a 16-bit match mask */
+static inline uint64_t match16(__m128i v, char c){
+    return (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(c)));
+}
+
+/* SSE2 scanner, four 16-byte lanes per block */
+static void scanSSE2(const char *p, struct csvMasks *masks){
+    uint64_t comma = 0, quote = 0, newline = 0;
+    for(int i = 0; i < CSVSCAN_BLOCK; i += 16){
+        __m128i v = _mm_loadu_si128((const __m128i *) (p + i));
+        comma |= match16(v, ',') << i;
+        quote |= match16(v, '\"') << i;
+        newline |= match16(v, '\n') << i;
+    }
+    masks->comma = comma;
+    masks->quote = quote;
+    masks->newline = newline;
+}
+
+/* Compare 32 bytes against c and return a 32-bit match mask */
+__attribute__((target("avx2")))
+static inline uint64_t match32(__m256i v, char c){
+    return (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(c)));
+}
+
+/* AVX2 scanner, two 32-byte lanes per block */
+__attribute__((target("avx2")))
+static void scanAVX2(const char *p, struct csvMasks *masks){
+    __m256i lo = _mm256_loadu_si256((const __m256i *) p);
+    __m256i hi = _mm256_loadu_si256((const __m256i *) (p + 32));
+    masks->comma = match32(lo, ',') | (match32(hi, ',') << 32);
+    masks->quote = match32(lo, '\"') | (match32(hi, '\"') << 32);
+    masks->newline = match32(lo, '\n') | (match32(hi, '\n') << 32);
+}
+#endif
+
+/* Pick the best scanner for this CPU, honouring the CSVSCAN override */
+__attribute__((constructor))
+static void csvScanInit(void){
+    const char *forced = getenv("CSVSCAN");
+    scanImpl = scanScalar;
+    if(forced && strcmp(forced, "scalar") == 0){
+        return;
+    }
+#ifdef CSVSCAN_X86
+    scanImpl = scanSSE2;
+    if(forced && strcmp(forced, "sse2") == 0){
+        return;
+    }
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")){
+        scanImpl = scanAVX2;
+    }
+#endif
+}
+
+void csvScanBlock(const char *p, struct csvMasks *masks){
+    scanImpl(p, masks);
+}
+
+void csvScanPartial(const char *p, size_t n, struct csvMasks *masks){
+    /* Pad with zero bytes, which never match. */
+    char block[CSVSCAN_BLOCK] = {0};
+    memcpy(block, p, n);
+    scanImpl(block, masks);
+}
+
+int csvQuoteParity(const char *p, size_t n, int carry){
+    struct csvMasks masks;
+    size_t done = 0;
+    while(done + CSVSCAN_BLOCK <= n){
+        scanImpl(p + done, &masks);
+        carry ^= __builtin_popcountll(masks.quote) & 1;
+        done += CSVSCAN_BLOCK;
+    }
+    if(done < n){
+        csvScanPartial(p + done, n - done, &masks);
+        carry ^= __builtin_popcountll(masks.quote) & 1;
+    }
+    return carry;
+}
@@ -0,0 +1,69 @@
+/*
+ * CSV Structural Scanner Header
+ *
+ * This header declares a vectorised scanner which classifies the structural
+ * characters of CSV data (commas, double quotes and line feeds) a block at a
+ * time. Each block is summarised as bitmasks, which lets the parser jump
+ * straight from one field boundary to the next instead of testing every byte.
+ *
+ * The scanner uses AVX2 when the CPU supports it, SSE2 as the x86 baseline,
+ * and a portable scalar loop otherwise. The CSVSCAN environment variable
+ * ("avx2", "sse2" or "scalar") can be used to force a given implementation.
+ */
+
+#ifndef CSVSCAN_H
+#define CSVSCAN_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Number of bytes classified by a single scan */
+#define CSVSCAN_BLOCK 64
+
+/*
+ * Structural character masks for one block
+ * Bit i of each mask is set when byte i of the block is that character
+ */
+struct csvMasks {
+    uint64_t comma;     // ','
+    uint64_t quote;     // '"'
+    uint64_t newline;   // '\n'
+};
+
+/* Classify the CSVSCAN_BLOCK bytes starting at p */
+void csvScanBlock(const char *p, struct csvMasks *masks);
+
+/*
+ * Classify the first n bytes starting at p, where n < CSVSCAN_BLOCK
+ * Bytes past n are never read and their bits are never set
+ */
+void csvScanPartial(const char *p, size_t n, struct csvMasks *masks);
+
+/*
+ * Returns the parity of the quotes in the n bytes starting at p, combined
+ * with the parity carried in from earlier data (0 or 1)
+ * A result of 1 means the data ends inside a quoted region
+ */
+int csvQuoteParity(const char *p, size_t n, int carry);
+
+/*
+ * Convert the quote mask of a block into a mask of the bytes inside quoted
+ * regions using a prefix XOR, so bit i holds the parity of the quotes up to
+ * and including byte i. *carry holds the quote state between blocks (all
+ * zeros outside quotes, all ones inside) and is updated for the next block.
+ * Commas and line feeds with their bit set are escaped.
+ */
+static inline uint64_t csvQuoteMask(uint64_t quotes, uint64_t *carry){
+    uint64_t mask = quotes;
+    mask ^= mask << 1;
+    mask ^= mask << 2;
+    mask ^= mask << 4;
+    mask ^= mask << 8;
+    mask ^= mask << 16;
+    mask ^= mask << 32;
+    mask ^= *carry;
+    *carry = (uint64_t) ((int64_t) mask >> 63);
+    return mask;
+}
+
+#endif
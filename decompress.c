@@ -0,0 +1,342 @@
+/*
+    Data structure and function implementations for a module which
+    transparently decompresses CSV input.
+*/
+#define _GNU_SOURCE
+#include "decompress.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/* Size of the buffer between the decompressing thread and the reader. */
+#define RING_BYTES (1 << 20)
+/* Size of the blocks read from the compressed input. */
+#define INPUT_BYTES (1 << 16)
+#define MAGIC_BYTES 4
+/* Window bits telling zlib to expect a gzip header. */
+#define GZIP_WINDOW (15 + 16)
+
+#define FORMAT_PLAIN 0
+#define FORMAT_GZIP 1
+#define FORMAT_ZSTD 2
+
+static const unsigned char gzipMagic[] = {0x1f, 0x8b};
+static const unsigned char zstdMagic[] = {0x28, 0xb5, 0x2f, 0xfd};
+
+/* State shared by the decompressing thread and the reader. */
+struct inflater {
+    FILE *in;
+    int closeIn;
+    int format;
+    /* Bytes already read from in while checking the magic. */
+    unsigned char prefix[MAGIC_BYTES];
+    size_t prefixLen;
+    size_t prefixUsed;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t readable;
+    pthread_cond_t writable;
+    /* Decompressed data waiting to be read, count bytes from head. */
+    char *ring;
+    size_t head;
+    size_t count;
+    /* Set by the thread when it has finished, and whether it failed. */
+    int done;
+    int failed;
+    /* Set by the reader when the stream is closed. */
+    int closing;
+};
+
+/* Returns non-zero if the n bytes at start match the start of magic. */
+static int matchesMagic(const unsigned char *start, size_t n,
+    const unsigned char *magic, size_t magicLen){
+    if(n > magicLen){
+        n = magicLen;
+    }
+    return n > 0 && memcmp(start, magic, n) == 0;
+}
+
+int looksCompressed(const unsigned char *start, size_t n){
+    return matchesMagic(start, n, gzipMagic, sizeof(gzipMagic))
+        || matchesMagic(start, n, zstdMagic, sizeof(zstdMagic));
+}
+
+/* Reads the next block of compressed input, starting with the prefix. */
+static size_t readInput(struct inflater *z, unsigned char *dest, size_t max){
+    if(z->prefixUsed < z->prefixLen){
+        size_t n = z->prefixLen - z->prefixUsed;
+        if(n > max){
+            n = max;
+        }
+        memcpy(dest, z->prefix + z->prefixUsed, n);
+        z->prefixUsed += n;
+        return n;
+    }
+    return fread(dest, 1, max, z->in);
+}
+
+/* Adds decompressed data to the ring, waiting for space as needed. Returns
+    -1 if the reader has gone away. */
+static int produce(struct inflater *z, const char *data, size_t n){
+    pthread_mutex_lock(&z->lock);
+    while(n > 0){
+        while(z->count == RING_BYTES && ! z->closing){
+            pthread_cond_wait(&z->writable, &z->lock);
+        }
+        if(z->closing){
+            pthread_mutex_unlock(&z->lock);
+            return -1;
+        }
+        size_t tail = (z->head + z->count) % RING_BYTES;
+        size_t space = RING_BYTES - z->count;
+        if(space > RING_BYTES - tail){
+            space = RING_BYTES - tail;
+        }
+        if(space > n){
+            space = n;
+        }
+        memcpy(z->ring + tail, data, space);
+        z->count += space;
+        data += space;
+        n -= space;
+        pthread_cond_signal(&z->readable);
+    }
+    pthread_mutex_unlock(&z->lock);
+    return 0;
+}
+
+/* Copies input that isn't compressed. Returns 0 on success. */
+static int copyPlain(struct inflater *z, unsigned char *in){
+    size_t got;
+    while((got = readInput(z, in, INPUT_BYTES)) > 0){
+        if(produce(z, (char *) in, got) < 0){
+            break;
+        }
+    }
+    return 0;
+}
+
+/* Decompresses gzip input, which may be several members one after another.
+    Returns 0 on success. */
+static int inflateGzip(struct inflater *z, unsigned char *in,
+    unsigned char *out){
+    z_stream s;
+    memset(&s, 0, sizeof(s));
+    if(inflateInit2(&s, GZIP_WINDOW) != Z_OK){
+        return -1;
+    }
+    int inMember = 0;
+    int failed = 0;
+    while(1){
+        if(s.avail_in == 0){
+            size_t got = readInput(z, in, INPUT_BYTES);
+            if(got == 0){
+                /* A member cut short means the file is truncated. */
+                failed = inMember;
+                break;
+            }
+            s.next_in = in;
+            s.avail_in = (uInt) got;
+        }
+        s.next_out = out;
+        s.avail_out = INPUT_BYTES;
+        int ret = inflate(&s, Z_NO_FLUSH);
+        if(ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR){
+            failed = 1;
+            break;
+        }
+        inMember = 1;
+        if(produce(z, (char *) out, INPUT_BYTES - s.avail_out) < 0){
+            break;
+        }
+        if(ret == Z_STREAM_END){
+            /* Another member may follow. */
+            inflateReset(&s);
+            inMember = 0;
+        }
+    }
+    inflateEnd(&s);
+    return failed ? -1 : 0;
+}
+
+#ifdef HAVE_ZSTD
+/* Decompresses zstd input, which may be several frames one after another.
+    Returns 0 on success. */
+static int inflateZstd(struct inflater *z, unsigned char *in,
+    unsigned char *out){
+    ZSTD_DStream *ds = ZSTD_createDStream();
+    if(! ds){
+        return -1;
+    }
+    ZSTD_initDStream(ds);
+    size_t pending = 0;
+    int failed = 0;
+    size_t got;
+    while((got = readInput(z, in, INPUT_BYTES)) > 0){
+        ZSTD_inBuffer input = {in, got, 0};
+        while(input.pos < input.size){
+            ZSTD_outBuffer output = {out, INPUT_BYTES, 0};
+            pending = ZSTD_decompressStream(ds, &output, &input);
+            if(ZSTD_isError(pending)){
+                failed = 1;
+                break;
+            }
+            if(produce(z, (char *) out, output.pos) < 0){
+                ZSTD_freeDStream(ds);
+                return 0;
+            }
+        }
+        if(failed){
+            break;
+        }
+    }
+    /* Anything still pending means the last frame is truncated. */
+    while(! failed && pending != 0){
+        ZSTD_inBuffer input = {in, 0, 0};
+        ZSTD_outBuffer output = {out, INPUT_BYTES, 0};
+        pending = ZSTD_decompressStream(ds, &output, &input);
+        if(ZSTD_isError(pending) || output.pos == 0){
+            failed = 1;
+            break;
+        }
+        if(produce(z, (char *) out, output.pos) < 0){
+            break;
+        }
+    }
+    ZSTD_freeDStream(ds);
+    return failed ? -1 : 0;
+}
+#endif
+
+/* Body of the decompressing thread. */
+static void *decompressThread(void *arg){
+    struct inflater *z = (struct inflater *) arg;
+    unsigned char *in = (unsigned char *) malloc(INPUT_BYTES);
+    unsigned char *out = (unsigned char *) malloc(INPUT_BYTES);
+    assert(in && out);
+
+    int result = 0;
+    switch(z->format){
+        case FORMAT_GZIP:
+            result = inflateGzip(z, in, out);
+            break;
+#ifdef HAVE_ZSTD
+        case FORMAT_ZSTD:
+            result = inflateZstd(z, in, out);
+            break;
+#endif
+        default:
+            result = copyPlain(z, in);
+    }
+    free(in);
+    free(out);
+
+    pthread_mutex_lock(&z->lock);
+    z->done = 1;
+    z->failed = (result != 0 || ferror(z->in));
+    pthread_cond_broadcast(&z->readable);
+    pthread_mutex_unlock(&z->lock);
+    return NULL;
+}
+
+/* Stream read function, hands out data from the ring. */
+static ssize_t readDecompressed(void *cookie, char *buf, size_t size){
+    struct inflater *z = (struct inflater *) cookie;
+    pthread_mutex_lock(&z->lock);
+    while(z->count == 0 && ! z->done){
+        pthread_cond_wait(&z->readable, &z->lock);
+    }
+    if(z->count == 0){
+        int failed = z->failed;
+        pthread_mutex_unlock(&z->lock);
+        if(failed){
+            fprintf(stderr, "Compressed input is corrupt or truncated\n");
+            return -1;
+        }
+        return 0;
+    }
+    size_t n = z->count;
+    if(n > RING_BYTES - z->head){
+        n = RING_BYTES - z->head;
+    }
+    if(n > size){
+        n = size;
+    }
+    memcpy(buf, z->ring + z->head, n);
+    z->head = (z->head + n) % RING_BYTES;
+    z->count -= n;
+    pthread_cond_signal(&z->writable);
+    pthread_mutex_unlock(&z->lock);
+    return (ssize_t) n;
+}
+
+/* Stream close function, stops the thread and frees the state. */
+static int closeDecompressed(void *cookie){
+    struct inflater *z = (struct inflater *) cookie;
+    pthread_mutex_lock(&z->lock);
+    z->closing = 1;
+    pthread_cond_broadcast(&z->writable);
+    pthread_mutex_unlock(&z->lock);
+    pthread_join(z->thread, NULL);
+
+    int result = 0;
+    if(z->closeIn){
+        result = fclose(z->in);
+    }
+    pthread_mutex_destroy(&z->lock);
+    pthread_cond_destroy(&z->readable);
+    pthread_cond_destroy(&z->writable);
+    free(z->ring);
+    free(z);
+    return result;
+}
+
+FILE *openDecompressed(FILE *in, int closeIn){
+    struct inflater *z = (struct inflater *) calloc(1, sizeof(struct inflater));
+    assert(z);
+    z->in = in;
+    z->closeIn = closeIn;
+    z->prefixLen = fread(z->prefix, 1, MAGIC_BYTES, in);
+    z->format = FORMAT_PLAIN;
+    if(matchesMagic(z->prefix, z->prefixLen, gzipMagic, sizeof(gzipMagic))
+        && z->prefixLen >= sizeof(gzipMagic)){
+        z->format = FORMAT_GZIP;
+    } else if(z->prefixLen == sizeof(zstdMagic)
+        && matchesMagic(z->prefix, z->prefixLen, zstdMagic, sizeof(zstdMagic))){
+#ifdef HAVE_ZSTD
+        z->format = FORMAT_ZSTD;
+#else
+        fprintf(stderr, "zstd input needs a build with zstd support "
+            "(make ZSTD=1)\n");
+        if(closeIn){
+            fclose(in);
+        }
+        free(z);
+        return NULL;
+#endif
+    }
+
+    z->ring = (char *) malloc(RING_BYTES);
+    assert(z->ring);
+    pthread_mutex_init(&z->lock, NULL);
+    pthread_cond_init(&z->readable, NULL);
+    pthread_cond_init(&z->writable, NULL);
+
+    cookie_io_functions_t io = {
+        .read = readDecompressed,
+        .write = NULL,
+        .seek = NULL,
+        .close = closeDecompressed
+    };
+    FILE *stream = fopencookie(z, "r", io);
+    assert(stream);
+    int err = pthread_create(&z->thread, NULL, decompressThread, z);
+    assert(err == 0);
+    return stream;
+}
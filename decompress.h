@@ -0,0 +1,26 @@
+/*
+    Data structure declarations and prototypes for a module which
+    transparently decompresses CSV input. gzip and zstd data is recognised by
+    its magic bytes and decompressed on a separate thread, which hands its
+    output to the reader through a bounded buffer so that reading the file,
+    decompressing it and parsing it all overlap.
+
+    zstd support needs the module built with HAVE_ZSTD (make ZSTD=1).
+*/
+#ifndef DECOMPRESS_H
+#define DECOMPRESS_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/* Returns non-zero if the n bytes at start could be the beginning of gzip or
+    zstd data. A single byte is enough to rule most input out. */
+int looksCompressed(const unsigned char *start, size_t n);
+
+/* Returns a stream which reads the data of in decompressed if it is gzip or
+    zstd, or unchanged otherwise, decompressing on its own thread. Closing the
+    returned stream stops the thread, and also closes in if closeIn is set.
+    Returns NULL if the data is compressed in a format this build can't read. */
+FILE *openDecompressed(FILE *in, int closeIn);
+
+#endif
@@ -6,11 +6,18 @@
         make dict1
     
     Run with
-        ./dict1 1 <input dataset> <output file> < <keys file>
+        ./dict1 1 <input dataset> <output file> [--threads <n>]
+            [--delta <change file>]... [--mem-report] < <keys file>
     Where
         <input dataset> is the filename of the input csv.
         <output file> is the filename of the output text file.
         <keys file> is a list of keys separated by newlines.
+        --threads <n> parses the dataset on n threads (0 uses every core).
+        --delta <change file> applies the changes in the file to the records
+            read from the dataset, see applyDelta. May be given more than
+            once, the files are applied in order.
+        --mem-report writes where the dictionary's memory goes to stderr
+            once every key has been looked up.
     
     Written by Grady Fitzpatrick for COMP20003 as a sample solution
     for Assignment 1
@@ -19,6 +26,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <unistd.h>
 #include "read.h"
 #include "dictionary.h"
 
@@ -27,6 +35,13 @@
 #define ALT_STAGE "2"
 #define STAGE (LOOKUPSTAGE)
 #define STAGE2 ()
+#define NUM_FIELDS 35
+
+/* Converts a row for readCSVParallel. */
+static void *convertRow(struct csvReader *reader, struct csvField *fields, 
+    int fieldCount, void *ud){
+    return a2_from_csvFields(reader, fields, fieldCount);
+}
 
 int main(int argc, char **argv){
     if(argc < MINARGS){
@@ -43,20 +58,68 @@ int main(int argc, char **argv){
     char *inputCSVName = argv[2];
     char *outputFileName = argv[3];
 
-    FILE *csvFile = fopen(inputCSVName, "r");
-    assert(csvFile);
+    int numThreads = 1;
+    char *deltaNames[argc];
+    int deltaCount = 0;
+    int memReport = 0;
+    for(int i = MINARGS; i < argc; i++){
+        if(strcmp(argv[i], "--threads") == 0 && (i + 1) < argc){
+            numThreads = atoi(argv[++i]);
+            if(numThreads <= 0){
+                numThreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+            }
+        } else if(strcmp(argv[i], "--delta") == 0 && (i + 1) < argc){
+            deltaNames[deltaCount++] = argv[++i];
+        } else if(strcmp(argv[i], "--mem-report") == 0){
+            memReport = 1;
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    struct csvReader *reader = openCSV(inputCSVName);
+    if(! reader){
+        fprintf(stderr, "Could not read %s\n", inputCSVName);
+        exit(EXIT_FAILURE);
+    }
     FILE *outputFile = fopen(outputFileName, "w");
     assert(outputFile);
     
-    int n;
-    struct csvRecord **dataset = readCSV(csvFile, &n);
-
     struct dictionary *dict = newDict();
 
-    for(int i = 0; i < n; i++){
-        insertRecord(dict, dataset[i]);
+    if(numThreads > 1){
+        int n;
+        void **records = readCSVParallel(reader, numThreads, NUM_FIELDS, 
+            convertRow, NULL, &n);
+        if(n < 0){
+            fprintf(stderr, "Could not read %s\n", inputCSVName);
+            exit(EXIT_FAILURE);
+        }
+        for(int i = 0; i < n; i++){
+            insertRow(dict, (a2_data *) records[i]);
+            a2_free((a2_data *) records[i]);
+        }
+        free(records);
+    } else {
+        struct csvField fields[NUM_FIELDS];
+        int fieldCount;
+        while((fieldCount = nextCSVRow(reader, fields, NUM_FIELDS)) > 0){
+            insertRecordFields(dict, reader, fields, fieldCount);
+        }
+        if(fieldCount < 0){
+            fprintf(stderr, "Could not read %s\n", inputCSVName);
+            exit(EXIT_FAILURE);
+        }
+    }
+    closeCSV(reader);
+
+    for(int i = 0; i < deltaCount; i++){
+        if(applyDelta(dict, deltaNames[i]) < 0){
+            fprintf(stderr, "Could not apply changes from %s\n", deltaNames[i]);
+            exit(EXIT_FAILURE);
+        }
     }
-    freeCSV(dataset, n);
 
     char *query = NULL;
     while((query = getQuery(stdin))){
@@ -67,10 +130,13 @@ int main(int argc, char **argv){
         free(query);
     }
 
+    if(memReport){
+        printMemoryReport(dict, stderr);
+    }
     freeDict(dict);
+    freeFieldEncodings();
     dict = NULL;
 
-    fclose(csvFile);
     fclose(outputFile);
 
     return EXIT_SUCCESS;
@@ -6,11 +6,36 @@
         make dict2
     
     Run with
-        ./dict2 2 <input dataset> <output file> < <keys file>
+        ./dict2 2 <input dataset> <output file> [--threads <n>]
+            [--save-snapshot <snapshot file>] [--lazy] [--row-cache] 
+            [--delta <change file>]... [--mem-report] [--crit-bit] 
+            [--freeze] < <keys file>
     Where
-        <input dataset> is the filename of the input csv.
+        <input dataset> is the filename of the input csv, or of a snapshot
+            saved by an earlier run.
         <output file> is the filename of the output text file.
         <keys file> is a list of keys separated by newlines.
+        --threads <n> parses the dataset and builds the trie on n threads 
+            (0 uses every core).
+        --save-snapshot <snapshot file> saves the built trie as a snapshot,
+            which later runs can load in place of the csv without parsing it
+            or rebuilding the trie.
+        --lazy keeps only the key of each record in memory, decoding the
+            rest of its row from the mapped csv when the record is output.
+        --row-cache keeps rows decoded by --lazy for reuse by later queries.
+        --delta <change file> applies the changes in the file to the trie
+            built from the dataset (before any snapshot is saved), see 
+            applyDelta. May be given more than once, the files are applied
+            in order. Snapshots and --lazy dictionaries can't be changed.
+        --mem-report writes where the dictionary's memory goes to stderr
+            once every key has been looked up.
+        --crit-bit builds a bitwise crit-bit trie rather than the character
+            trie. The same records are found, but the comparisons counted 
+            are the crit-bit trie's. Can't be used with --save-snapshot, and
+            has no effect on a snapshot.
+        --freeze converts the trie, once built and changed, into the compact
+            layout of a snapshot held in memory before any key is looked up.
+            Can't be used with --crit-bit, and has no effect on a snapshot.
     
     Written for COMP20003 Assignment 2 - Stage 2
     Uses Patricia Trie for efficient exact and approximate string matching
@@ -19,9 +44,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <unistd.h>
 #include "read.h"
 #include "a2data.h"
-#include "patricia.h"
 #include "metrics.h"
 #include "dictionary.h"
 
@@ -31,6 +56,84 @@
 #define STAGE (LOOKUPSTAGE)
 #define STAGE2 ()
 
+/* Converts a row for readCSVParallel. Rows for a lazy dictionary are left
+    to be inserted from their fields, which are just copied. */
+static void *convertRow(struct csvReader *reader, struct csvField *fields, 
+    int fieldCount, void *ud){
+    int lazy = *(int *) ud;
+    if(lazy){
+        struct csvField *copy = malloc(sizeof(struct csvField) * fieldCount);
+        assert(copy);
+        memcpy(copy, fields, sizeof(struct csvField) * fieldCount);
+        return copy;
+    }
+    return a2_from_csvFields(reader, fields, fieldCount);
+}
+
+/* Read the dataset into a new Patricia Trie dictionary, parsing and indexing
+    on numThreads threads. If lazy is set and the dataset can be mapped, only 
+    the key of each record is held and the rest is decoded from the mapping 
+    when used. */
+static struct patriciaDict *buildTree(char *inputCSVName, int numThreads, 
+    int lazy, int cacheRows, int critBit){
+    struct csvReader *reader = openCSV(inputCSVName);
+    if(! reader){
+        fprintf(stderr, "Could not read %s\n", inputCSVName);
+        exit(EXIT_FAILURE);
+    }
+
+    struct patriciaDict *dict;
+    lazy = lazy && csvMapped(reader);
+    if(lazy){
+        /* The dictionary keeps the reader until it is freed. */
+        dict = newLazyPatriciaDict(reader, cacheRows);
+    } else {
+        dict = newPatriciaDict();
+    }
+    if(critBit){
+        usePatriciaCritBit(dict);
+    }
+    startPatriciaLoad(dict);
+
+    if(numThreads > 1){
+        /* Parse in parallel, then insert in file order. */
+        int n;
+        void **rows = readCSVParallel(reader, numThreads, A2_NUM_FIELDS, 
+            convertRow, &lazy, &n);
+        if(n < 0){
+            fprintf(stderr, "Could not read %s\n", inputCSVName);
+            exit(EXIT_FAILURE);
+        }
+        for(int i = 0; i < n; i++){
+            if(lazy){
+                insertPatriciaFields(dict, reader, (struct csvField *) rows[i],
+                    A2_NUM_FIELDS);
+                free(rows[i]);
+            } else {
+                insertPatriciaRow(dict, (a2_data *) rows[i]);
+                a2_free((a2_data *) rows[i]);
+            }
+        }
+        free(rows);
+    } else {
+        struct csvField fields[A2_NUM_FIELDS];
+        int fieldCount;
+        while((fieldCount = nextCSVRow(reader, fields, A2_NUM_FIELDS)) > 0){
+            insertPatriciaFields(dict, reader, fields, fieldCount);
+        }
+        if(fieldCount < 0){
+            fprintf(stderr, "Could not read %s\n", inputCSVName);
+            exit(EXIT_FAILURE);
+        }
+    }
+    finishPatriciaLoad(dict, numThreads);
+    if(! lazy){
+        closeCSV(reader);
+    }
+
+    return dict;
+}
+
 int main(int argc, char **argv){
     if(argc < MINARGS){
         fprintf(stderr, "Insufficient arguments, run in form:\n"
@@ -46,36 +149,101 @@ int main(int argc, char **argv){
     char *inputCSVName = argv[2];
     char *outputFileName = argv[3];
 
-    FILE *csvFile = fopen(inputCSVName, "r");
-    assert(csvFile);
+    int numThreads = 1;
+    char *snapshotName = NULL;
+    int lazy = 0;
+    int cacheRows = 0;
+    char *deltaNames[argc];
+    int deltaCount = 0;
+    int memReport = 0;
+    int critBit = 0;
+    int freeze = 0;
+    for(int i = MINARGS; i < argc; i++){
+        if(strcmp(argv[i], "--threads") == 0 && (i + 1) < argc){
+            numThreads = atoi(argv[++i]);
+            if(numThreads <= 0){
+                numThreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+            }
+        } else if(strcmp(argv[i], "--save-snapshot") == 0 && (i + 1) < argc){
+            snapshotName = argv[++i];
+        } else if(strcmp(argv[i], "--lazy") == 0){
+            lazy = 1;
+        } else if(strcmp(argv[i], "--row-cache") == 0){
+            cacheRows = 1;
+        } else if(strcmp(argv[i], "--delta") == 0 && (i + 1) < argc){
+            deltaNames[deltaCount++] = argv[++i];
+        } else if(strcmp(argv[i], "--mem-report") == 0){
+            memReport = 1;
+        } else if(strcmp(argv[i], "--crit-bit") == 0){
+            critBit = 1;
+        } else if(strcmp(argv[i], "--freeze") == 0){
+            freeze = 1;
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if(critBit && snapshotName){
+        fprintf(stderr, "Crit-bit tries can't be saved as snapshots\n");
+        exit(EXIT_FAILURE);
+    }
+    if(critBit && freeze){
+        fprintf(stderr, "Crit-bit tries can't be frozen\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* A snapshot is searched where it is mapped, there's nothing to build. */
+    int snapshotVersion;
+    struct patriciaDict *dict = openPatriciaSnapshot(inputCSVName, 
+        &snapshotVersion);
+    if(! dict && snapshotVersion >= 0){
+        fprintf(stderr, "%s is not a valid snapshot (version %d)\n", 
+            inputCSVName, snapshotVersion);
+        exit(EXIT_FAILURE);
+    }
+    if(dict && snapshotName){
+        fprintf(stderr, "%s is already a snapshot\n", inputCSVName);
+        exit(EXIT_FAILURE);
+    }
+
     FILE *outputFile = fopen(outputFileName, "w");
     assert(outputFile);
     
-    int n;
-    struct csvRecord **dataset = readCSV(csvFile, &n);
-
-    ptree_t *tree = newPatriciaDict();
-
-    for(int i = 0; i < n; i++){
-        a2_data *d = a2_from_csvRecord(dataset[i]);
-        const char *key = d->fields[1];  // EZI_ADD field
-        insertPatriciaRecord(tree, d, key);
+    if(!dict){
+        dict = buildTree(inputCSVName, numThreads, lazy, cacheRows, critBit);
+    }
+    for(int i = 0; i < deltaCount; i++){
+        if(applyPatriciaDelta(dict, deltaNames[i]) < 0){
+            fprintf(stderr, "Could not apply changes from %s\n", deltaNames[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if(snapshotName && savePatriciaSnapshot(dict, snapshotName) != 0){
+        fprintf(stderr, "Could not write snapshot %s\n", snapshotName);
+        exit(EXIT_FAILURE);
+    }
+    if(freeze){
+        /* A snapshot has no trie to freeze, it's laid out the same already. */
+        freezePatriciaDict(dict);
     }
-    freeCSV(dataset, n);
 
     char *query = NULL;
     while((query = getQuery(stdin))){
-        struct queryResult *r = lookupPatriciaRecord(tree, query);
+        struct queryResult *r = lookupPatriciaRecord(dict, query);
         /* BINARYOUTPUTSTAGE outputs binary versions of the key in addition to the key */
         printQueryResult(r, stdout, outputFile, STAGE);
         freeQueryResult(r);
         free(query);
     }
 
-    freePatriciaDict(tree);
-    tree = NULL;
+    if(memReport){
+        printPatriciaMemoryReport(dict, stderr);
+    }
+    freePatriciaDict(dict);
+    dict = NULL;
+    freeFieldEncodings();
 
-    fclose(csvFile);
     fclose(outputFile);
 
     return EXIT_SUCCESS;
@@ -4,29 +4,34 @@
     for particular values.
 */
 #include "dictionary.h"
-#include "record_struct.h"
 #include "bit.h"
 #include "patricia.h"
-#include "a2data.h"
+#include "critbit.h"
+#include "snapshot.h"
+#include "recstore.h"
 #include "editdist.h"
 #include "metrics.h"
+#include "intern.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
 #include <stdbool.h>
 
-#define NUMERIC_BASE 10
 #define KEY_FIELD 1
 #define NOTFOUND "NOTFOUND"
 #define NOTDOUBLE (-1)
 #define MAXPRECISION (-2)
 #define NUM_FIELDS 35
 
-#define FIELDLOOKUPFAILURE (-1)
-
 #define INDEXINITIAL 1
 
+/* Change files hold a CHANGE column before the fields of each record. */
+#define DELTA_FIELDS (NUM_FIELDS + 1)
+#define CHANGE_ADD "ADD"
+#define CHANGE_UPDATE "UPDATE"
+#define CHANGE_RETIRE "RETIRE"
+
 // Field names by index.
 static char *fieldNames[] = {
     "PFI",
@@ -83,486 +88,120 @@ struct queryResult {
     char *searchString;
     int numRecords;
     double closestValue;
-    struct data **records;
-    a2_data **a2_records;  // For Patricia Trie results
+    const recordId *records;
+    int ownsRecords;            // Records were allocated for the result
+    struct recordStore *store;  // Store the records are in
     int bitCount;
     int nodeCount;
     int stringCount;
-    int isPatriciaResult;  // Flag to indicate if this is from Patricia Trie
-};
-
-/* CSV records. */
-struct data;
-struct data {
-    char *PFI;
-    char *EZI_ADD;
-    char *SRC_VERIF;
-    char *PROPSTATUS;
-    char *GCODEFEAT;
-    char *LOC_DESC;
-    char *BLGUNTTYP;
-    char *HSAUNITID;
-    char *BUNIT_PRE1;
-    char *BUNIT_ID1;
-    char *BUNIT_SUF1;
-    char *BUNIT_PRE2;
-    char *BUNIT_ID2;
-    char *BUNIT_SUF2;
-    char *FLOOR_TYPE;
-    char *FLOOR_NO_1;
-    char *FLOOR_NO_2;
-    char *BUILDING;
-    char *COMPLEX;
-    char *HSE_PREF1;
-    char *HSE_NUM1;
-    char *HSE_SUF1;
-    char *HSE_PREF2;
-    char *HSE_NUM2;
-    char *HSE_SUF2;
-    char *DISP_NUM1;
-    char *ROAD_NAME;
-    char *ROAD_TYPE;
-    char *RD_SUF;
-    char *LOCALITY;
-    char *STATE;
-    char *POSTCODE;
-    char *ACCESSTYPE;
-    long double x;
-    long double y;
-};
-
-/* A node in the dictionary, used to allow quick lookup. */
-struct dictionaryNode;
-
-struct dictionaryNode{
-    struct data *record;
-    struct dictionaryNode *next;
 };
 
+/* Index of the records sorted on a (double) field. */
 struct index;
 
 struct index {
     int valueCount;
-    struct dictionaryNode **nodes;
+    recordId *ids;
 };
 
-/* Dictionary - concrete data structure is linked list. */
+/* Dictionary - records are kept in a columnar store, in insertion order. */
 struct dictionary {
-    struct dictionaryNode *head;
-    struct dictionaryNode *tail;
+    struct recordStore *store;
     struct index **indices;
 };
 
-/* Reads a given string as an integer and returns the integer. */
-int readIntField(char *fieldString);
-
-/* Reads a given string as a string and returns a copy of the string. */
-char *readStringField(char *fieldString);
-
-/* Reads a given string as a double value and returns the double value. */
-double readDoubleField(char *fieldString);
-
-int readIntField(char *fieldString){
-    return strtol(fieldString, NULL, NUMERIC_BASE);
-}
-
-char *readStringField(char *fieldString){
-    char *str = strdup(fieldString);
-    assert(str);
-    return str;
-}
-
-double readDoubleField(char *fieldString){
-    return strtod(fieldString, NULL);
-}
-
-/* Sets the relevant field. */
-void setField(struct data *record, int fieldIndex, char *fieldVal);
-
-void setField(struct data *record, int fieldIndex, char *fieldVal){
-    switch(fieldIndex){
-        case 0:
-            record->PFI = readStringField(fieldVal);
-            break;
-        case 1:
-            record->EZI_ADD = readStringField(fieldVal);
-            break;
-        case 2:
-            record->SRC_VERIF = readStringField(fieldVal);
-            break;
-        case 3:
-            record->PROPSTATUS = readStringField(fieldVal);
-            break;
-        case 4:
-            record->GCODEFEAT = readStringField(fieldVal);
-            break;
-        case 5:
-            record->LOC_DESC = readStringField(fieldVal);
-            break;
-        case 6:
-            record->BLGUNTTYP = readStringField(fieldVal);
-            break;
-        case 7:
-            record->HSAUNITID = readStringField(fieldVal);
-            break;
-        case 8:
-            record->BUNIT_PRE1 = readStringField(fieldVal);
-            break;
-        case 9:
-            record->BUNIT_ID1 = readStringField(fieldVal);
-            break;
-        case 10:
-            record->BUNIT_SUF1 = readStringField(fieldVal);
-            break;
-        case 11:
-            record->BUNIT_PRE2 = readStringField(fieldVal);
-            break;
-        case 12:
-            record->BUNIT_ID2 = readStringField(fieldVal);
-            break;
-        case 13:
-            record->BUNIT_SUF2 = readStringField(fieldVal);
-            break;
-        case 14:
-            record->FLOOR_TYPE = readStringField(fieldVal);
-            break;
-        case 15:
-            record->FLOOR_NO_1 = readStringField(fieldVal);
-            break;
-        case 16:
-            record->FLOOR_NO_2 = readStringField(fieldVal);
-            break;
-        case 17:
-            record->BUILDING = readStringField(fieldVal);
-            break;
-        case 18:
-            record->COMPLEX = readStringField(fieldVal);
-            break;
-        case 19:
-            record->HSE_PREF1 = readStringField(fieldVal);
-            break;
-        case 20:
-            record->HSE_NUM1 = readStringField(fieldVal);
-            break;
-        case 21:
-            record->HSE_SUF1 = readStringField(fieldVal);
-            break;
-        case 22:
-            record->HSE_PREF2 = readStringField(fieldVal);
-            break;
-        case 23:
-            record->HSE_NUM2 = readStringField(fieldVal);
-            break;
-        case 24:
-            record->HSE_SUF2 = readStringField(fieldVal);
-            break;
-        case 25:
-            record->DISP_NUM1 = readStringField(fieldVal);
-            break;
-        case 26:
-            record->ROAD_NAME = readStringField(fieldVal);
-            break;
-        case 27:
-            record->ROAD_TYPE = readStringField(fieldVal);
-            break;
-        case 28:
-            record->RD_SUF = readStringField(fieldVal);
-            break;
-        case 29:
-            record->LOCALITY = readStringField(fieldVal);
-            break;
-        case 30:
-            record->STATE = readStringField(fieldVal);
-            break;
-        case 31:
-            record->POSTCODE = readStringField(fieldVal);
-            break;
-        case 32:
-            record->ACCESSTYPE = readStringField(fieldVal);
-            break;
-        case 33:
-            record->x = readDoubleField(fieldVal);
-            break;
-        case 34:
-            record->y = readDoubleField(fieldVal);
-            break;
-        default:
-            fprintf(stderr, "%d: Unhandled field number %d\n", __LINE__, 
-                fieldIndex);
-            assert(fieldIndex >= 0 && fieldIndex < NUM_FIELDS);
-    }
-}
+/* Patricia Trie dictionary, searching either a trie, a crit-bit trie or a
+    mapped snapshot. */
+struct patriciaDict {
+    ptree_t *tree;
+    cbtree_t *critbit;
+    pt_snapshot_t *snapshot;
+    struct recordStore *store;
+    int loading;    // Records are indexed once loading finishes
+};
 
 /* Returns the double value for the given field index. */
-double getDoubleVal(struct data *record, int fieldIndex);
-
-double getDoubleVal(struct data *record, int fieldIndex){
-    switch(fieldIndex){
-        case 33:
-            return record->x;
-        case 34:
-            return record->y;
-        case 0:
-        case 1:
-        case 2:
-        case 3:
-        case 4:
-        case 5:
-        case 6:
-        case 7:
-        case 8:
-        case 9:
-        case 10:
-        case 11:
-        case 12:
-        case 13:
-        case 14:
-        case 15:
-        case 16:
-        case 17:
-        case 18:
-        case 19:
-        case 20:
-        case 21:
-        case 22:
-        case 23:
-        case 24:
-        case 25:
-        case 26:
-        case 27:
-        case 28:
-        case 29:
-        case 30:
-        case 31:
-        case 32:
-            fprintf(stderr, "%d: Unhandled non-double field number %d\n", __LINE__, 
-                fieldIndex);
-            assert(0);
-            break;
-        default:
-            fprintf(stderr, "%d: Unhandled field number %d\n", __LINE__, 
-                fieldIndex);
-            assert(fieldIndex >= 0 && fieldIndex < NUM_FIELDS && 0);
+double getDoubleVal(struct recordStore *store, recordId id, int fieldIndex);
+
+double getDoubleVal(struct recordStore *store, recordId id, int fieldIndex){
+    if(fieldIndex < 0 || fieldIndex >= NUM_FIELDS 
+        || fieldPrecision[fieldIndex] == NOTDOUBLE){
+        fprintf(stderr, "%d: Unhandled non-double field number %d\n", __LINE__, 
+            fieldIndex);
+        assert(0);
     }
-    return FIELDLOOKUPFAILURE;
+    return storeDouble(store, id, fieldIndex);
 }
 
-/* Prints a given value. */
-void printIntField(FILE *f, int value);
-
-/* Prints a given value. */
-void printStringField(FILE *f, char *value);
-
 /* Prints a given value. */
 void printDoubleField(FILE *f, double value, int fieldPrecision);
 
-void printIntField(FILE *f, int value){
-    fprintf(f, "%d", value);
-}
-
-void printStringField(FILE *f, char *value){
-    fprintf(f, "%s", value);
-}
-
 void printDoubleField(FILE *f, double value, int fieldPrecision){
     fprintf(f, "%.*f", fieldPrecision, value);
 }
 
 /* Prints the relevant field. */
-void printField(FILE *f, struct data *record, int fieldIndex);
+void printField(FILE *f, struct recordStore *store, recordId id, int fieldIndex);
 
-/* Print a single field of an a2_data record. */
-void printA2Field(FILE *f, a2_data *record, int fieldIndex){
-    if(fieldIndex < 0 || fieldIndex >= A2_NUM_FIELDS){
-        fprintf(f, "INVALID_FIELD");
+void printField(FILE *f, struct recordStore *store, recordId id, int fieldIndex){
+    assert(fieldIndex >= 0 && fieldIndex < NUM_FIELDS);
+    if(fieldPrecision[fieldIndex] != NOTDOUBLE){
+        printDoubleField(f, getDoubleVal(store, id, fieldIndex), 
+            fieldPrecision[fieldIndex]);
         return;
     }
-    
-    if(fieldIndex == 33 || fieldIndex == 34){
-        // Fields 33 and 34 are x,y coordinates - convert to double
-        double val = strtod(record->fields[fieldIndex], NULL);
-        printDoubleField(f, val, fieldPrecision[fieldIndex]);
-    } else {
-        // All other fields are strings
-        printStringField(f, record->fields[fieldIndex]);
-    }
-}
-
-void printField(FILE *f, struct data *record, int fieldIndex){
-    switch(fieldIndex){
-        case 0:
-            printStringField(f, record->PFI);
-            break;
-        case 1:
-            printStringField(f, record->EZI_ADD);
-            break;
-        case 2:
-            printStringField(f, record->SRC_VERIF);
-            break;
-        case 3:
-            printStringField(f, record->PROPSTATUS);
-            break;
-        case 4:
-            printStringField(f, record->GCODEFEAT);
-            break;
-        case 5:
-            printStringField(f, record->LOC_DESC);
-            break;
-        case 6:
-            printStringField(f, record->BLGUNTTYP);
-            break;
-        case 7:
-            printStringField(f, record->HSAUNITID);
-            break;
-        case 8:
-            printStringField(f, record->BUNIT_PRE1);
-            break;
-        case 9:
-            printStringField(f, record->BUNIT_ID1);
-            break;
-        case 10:
-            printStringField(f, record->BUNIT_SUF1);
-            break;
-        case 11:
-            printStringField(f, record->BUNIT_PRE2);
-            break;
-        case 12:
-            printStringField(f, record->BUNIT_ID2);
-            break;
-        case 13:
-            printStringField(f, record->BUNIT_SUF2);
-            break;
-        case 14:
-            printStringField(f, record->FLOOR_TYPE);
-            break;
-        case 15:
-            printStringField(f, record->FLOOR_NO_1);
-            break;
-        case 16:
-            printStringField(f, record->FLOOR_NO_2);
-            break;
-        case 17:
-            printStringField(f, record->BUILDING);
-            break;
-        case 18:
-            printStringField(f, record->COMPLEX);
-            break;
-        case 19:
-            printStringField(f, record->HSE_PREF1);
-            break;
-        case 20:
-            printStringField(f, record->HSE_NUM1);
-            break;
-        case 21:
-            printStringField(f, record->HSE_SUF1);
-            break;
-        case 22:
-            printStringField(f, record->HSE_PREF2);
-            break;
-        case 23:
-            printStringField(f, record->HSE_NUM2);
-            break;
-        case 24:
-            printStringField(f, record->HSE_SUF2);
-            break;
-        case 25:
-            printStringField(f, record->DISP_NUM1);
-            break;
-        case 26:
-            printStringField(f, record->ROAD_NAME);
-            break;
-        case 27:
-            printStringField(f, record->ROAD_TYPE);
-            break;
-        case 28:
-            printStringField(f, record->RD_SUF);
-            break;
-        case 29:
-            printStringField(f, record->LOCALITY);
-            break;
-        case 30:
-            printStringField(f, record->STATE);
-            break;
-        case 31:
-            printStringField(f, record->POSTCODE);
-            break;
-        case 32:
-            printStringField(f, record->ACCESSTYPE);
-            break;
-        case 33:
-            printDoubleField(f, record->x, fieldPrecision[fieldIndex]);
-            break;
-        case 34:
-            printDoubleField(f, record->y, fieldPrecision[fieldIndex]);
-            break;
-        default:
-            fprintf(stderr, "%d: Unhandled field number %d\n", __LINE__, 
-                fieldIndex);
-            assert(fieldIndex >= 0 && fieldIndex < NUM_FIELDS);
-    }
+    char buf[STORE_TEXT_CHARS];
+    unsigned int length;
+    const char *text = storeText(store, id, fieldIndex, buf, &length);
+    fwrite(text, sizeof(char), length, f);
 }
 
 struct dictionary *newDict(){
     struct dictionary *ret = (struct dictionary *) 
         malloc(sizeof(struct dictionary));
     assert(ret);
-    ret->head = NULL;
-    ret->tail = NULL;
+    ret->store = newRecordStore();
     ret->indices = NULL;
     return ret;
 }
 
-/* Read a record into a typed data structure. */
-struct data *readRecord(struct csvRecord *record);
-
-struct data *readRecord(struct csvRecord *record){
-    struct data *ret = (struct data *) malloc(sizeof(struct data));
-    assert(ret);
-    assert(record->fieldCount == NUM_FIELDS);
-    for(int i = 0; i < NUM_FIELDS; i++){
-        setField(ret, i, record->fields[i]);
+void insertRow(struct dictionary *dict, a2_data *row){
+    if(! dict){
+        return;
     }
-    return ret;
-};
+    storeAddRow(dict->store, row);
+}
 
-void insertRecord(struct dictionary *dict, struct csvRecord *record){
+void insertRecordFields(struct dictionary *dict, struct csvReader *reader,
+    struct csvField *fields, int fieldCount){
     if(! dict){
         return;
     }
-    struct dictionaryNode *newNode = (struct dictionaryNode *) 
-        malloc(sizeof(struct dictionaryNode));
-    assert(newNode);
-    newNode->record = readRecord(record);
-    newNode->next = NULL;
-
-    if(! (dict->head)){
-        /* First insertion, insert new node as head and tail. */
-        dict->head = newNode;
-        dict->tail = newNode;
-    } else {
-        /* Insert at tail. */
-        dict->tail->next = newNode;
-        dict->tail = newNode;
-    }
+    storeAddFields(dict->store, reader, fields, fieldCount);
 }
 
 /* Search for a given key in the dictionary. */
 struct queryResult *lookupRecord(struct dictionary *dict, char *query){
     int numRecords = 0;
-    struct data **records = NULL;
+    recordId *records = NULL;
     int bitCount = 0;
     int nodeCount = 0;
     int stringCount = 0;
     int queryBitCount = (strlen(query) + 1) * BITS_PER_BYTE;
 
     /* Iterate over all records and collect all matching records. */
-    struct dictionaryNode *current = dict->head;
-    while(current){
-        /* One string is stored per node, so these are equivalent. */
+    uint32_t recordCount = storeRecordCount(dict->store);
+    for(recordId id = 0; id < recordCount; id++){
+        if(storeIsRetired(dict->store, id)){
+            continue;
+        }
+        /* One string is stored per record, so these are equivalent. */
         nodeCount++;
         stringCount++;
 
-        int nodeBitCount = (strlen(current->record->EZI_ADD) + 1) * BITS_PER_BYTE;
+        unsigned int keyLength;
+        char *key = (char *) storeKey(dict->store, id, &keyLength);
+        int nodeBitCount = (keyLength + 1) * BITS_PER_BYTE;
 
         for(int i = 0; i <= nodeBitCount && i <= queryBitCount; i++){
             if(i == queryBitCount && i == nodeBitCount){
@@ -570,11 +209,11 @@ struct queryResult *lookupRecord(struct dictionary *dict, char *query){
                 // bitCount += BITS_PER_BYTE;
                 // struct data **new_records = (struct data **) realloc(records, 
                 //     sizeof(struct data *) * (numRecords + 1));
-                records = realloc(records, sizeof(struct data *) * (numRecords + 1));
+                records = realloc(records, sizeof(recordId) * (numRecords + 1));
                 assert(records);
                 // assert(new_records);
                 // records = new_records;
-                records[numRecords] = current->record;
+                records[numRecords] = id;
                 numRecords++;
                 break;
             } else if(i == queryBitCount || i == nodeBitCount){
@@ -584,12 +223,11 @@ struct queryResult *lookupRecord(struct dictionary *dict, char *query){
             } else {
                 /* Bit compared, regardless of success. */
                 bitCount++;
-                if(getBit(query, i) != getBit(current->record->EZI_ADD, i)){
+                if(getBit(query, i) != getBit(key, i)){
                     break;
                 }
             }
         }
-        current = current->next;
     }
 
     struct queryResult *qr = (struct queryResult *) 
@@ -600,11 +238,11 @@ struct queryResult *lookupRecord(struct dictionary *dict, char *query){
     assert(qr->searchString);
     qr->numRecords = numRecords;
     qr->records = records;
-    qr->a2_records = NULL;
+    qr->ownsRecords = 1;
+    qr->store = dict->store;
     qr->bitCount = bitCount;
     qr->nodeCount = nodeCount;
     qr->stringCount = stringCount;
-    qr->isPatriciaResult = 0;
     return qr;
 }
 
@@ -645,11 +283,7 @@ void printQueryResult(struct queryResult *r, FILE *summaryFile,
             fprintf(outputFile, "--> ");
             for(int j = 0; j < NUM_FIELDS; j++){
                 fprintf(outputFile, "%s: ", fieldNames[j]);
-                if(r->isPatriciaResult && r->a2_records){
-                    printA2Field(outputFile, r->a2_records[i], j);
-                } else {
-                    printField(outputFile, r->records[i], j);
-                }
+                printField(outputFile, r->store, r->records[i], j);
                 fprintf(outputFile, " || ");
             }
             fprintf(outputFile, "\n");
@@ -664,40 +298,41 @@ struct index *buildDoubleIndex(struct dictionary *dict, int fieldIndex){
     struct index *index = (struct index *) malloc(sizeof(struct index));
     assert(index);
     int valueCount = 0;
-    struct dictionaryNode **nodes = NULL;
+    recordId *ids = NULL;
     
-    int nodeSpace = 0;
+    int idSpace = 0;
 
-    nodes = (struct dictionaryNode **) malloc(sizeof(struct dictionaryNode *) * INDEXINITIAL);
-    assert(nodes);
-    nodeSpace = INDEXINITIAL;
+    ids = (recordId *) malloc(sizeof(recordId) * INDEXINITIAL);
+    assert(ids);
+    idSpace = INDEXINITIAL;
 
     /* Insertion sort. */
-    struct dictionaryNode *current = dict->head;
-
-    while(current){
-        if(valueCount == nodeSpace){
-            nodeSpace *= 2;
-            nodes = (struct dictionaryNode **) realloc(nodes, 
-                sizeof(struct dictionaryNode *) * nodeSpace);
-            assert(nodes);            
+    uint32_t recordCount = storeRecordCount(dict->store);
+    for(recordId id = 0; id < recordCount; id++){
+        if(storeIsRetired(dict->store, id)){
+            continue;
         }
-        nodes[valueCount] = current;
+        if(valueCount == idSpace){
+            idSpace *= 2;
+            ids = (recordId *) realloc(ids, sizeof(recordId) * idSpace);
+            assert(ids);            
+        }
+        ids[valueCount] = id;
+        double value = getDoubleVal(dict->store, id, fieldIndex);
         for(int j = valueCount - 1; j >= 0; j--){
-            if(getDoubleVal(current->record, fieldIndex) < getDoubleVal(nodes[j]->record, fieldIndex)){
-                nodes[j + 1] = nodes[j];
-                nodes[j] = current;
+            if(value < getDoubleVal(dict->store, ids[j], fieldIndex)){
+                ids[j + 1] = ids[j];
+                ids[j] = id;
             } else {
                 /* Sorted. */
                 break;
             }
         }
         valueCount++;
-        current = current->next;
     }
 
     index->valueCount = valueCount;
-    index->nodes = nodes;
+    index->ids = ids;
 
     return index;
 }
@@ -724,9 +359,9 @@ struct queryResult *searchClosestDouble(struct dictionary *dict, char *query,
     int lowIdx = 0;
     while(highIdx > lowIdx){
         int mid = (highIdx + lowIdx) / 2;
-        if(getDoubleVal(index->nodes[mid]->record, fieldIndex) < searchVal){
+        if(getDoubleVal(dict->store, index->ids[mid], fieldIndex) < searchVal){
             lowIdx = mid + 1;
-        } else if (getDoubleVal(index->nodes[mid]->record, fieldIndex) > searchVal){
+        } else if (getDoubleVal(dict->store, index->ids[mid], fieldIndex) > searchVal){
             highIdx = mid - 1;
         } else {
             // Exact match. Terminate early.
@@ -740,14 +375,14 @@ struct queryResult *searchClosestDouble(struct dictionary *dict, char *query,
     } else if(currentIdx >= index->valueCount){
         currentIdx = index->valueCount - 1;
     }
-    double closestProximity = getDoubleVal(index->nodes[currentIdx]->record, fieldIndex) - searchVal;
+    double closestProximity = getDoubleVal(dict->store, index->ids[currentIdx], fieldIndex) - searchVal;
     /* Check surrounding values */
     if(closestProximity < 0){
         /* searchVal is larger than the current index. */
         closestProximity = -closestProximity;
         /* Check if value higher is closer. */
         if((currentIdx + 1) < index->valueCount){
-            double candidateProximity = getDoubleVal(index->nodes[currentIdx + 1]->record, fieldIndex) 
+            double candidateProximity = getDoubleVal(dict->store, index->ids[currentIdx + 1], fieldIndex) 
                 - searchVal;
             if(candidateProximity < 0){
                 candidateProximity = -candidateProximity;
@@ -759,7 +394,7 @@ struct queryResult *searchClosestDouble(struct dictionary *dict, char *query,
     } else {
         /* searchVal is smaller or equal to the current index. */
         if((currentIdx - 1) >= 0){
-            double candidateProximity = getDoubleVal(index->nodes[currentIdx - 1]->record, fieldIndex) 
+            double candidateProximity = getDoubleVal(dict->store, index->ids[currentIdx - 1], fieldIndex) 
                 - searchVal;
             if(candidateProximity < 0){
                 candidateProximity = -candidateProximity;
@@ -776,21 +411,20 @@ struct queryResult *searchClosestDouble(struct dictionary *dict, char *query,
 
     int numRecords = 1;
 
-    struct data **records = (struct data **) 
-        malloc(sizeof(struct data *) * (numRecords));
+    recordId *records = (recordId *) malloc(sizeof(recordId) * (numRecords));
     assert(records);
 
-    records[0] = index->nodes[currentIdx]->record;
+    records[0] = index->ids[currentIdx];
 
-    double closestValue = getDoubleVal(index->nodes[currentIdx]->record, fieldIndex);
+    double closestValue = getDoubleVal(dict->store, index->ids[currentIdx], fieldIndex);
 
     qr->searchString = strdup(query);
     assert(qr->searchString);
     qr->numRecords = numRecords;
     qr->records = records;
-    qr->a2_records = NULL;
+    qr->ownsRecords = 1;
+    qr->store = dict->store;
     qr->closestValue = closestValue;
-    qr->isPatriciaResult = 0;
     
     return qr;
 }
@@ -801,162 +435,433 @@ void freeQueryResult(struct queryResult *r){
     if(! r){
         return;
     }
-    free(r->records);
-    free(r->a2_records);
+    if(r->ownsRecords){
+        free((recordId *) r->records);
+    }
     free(r->searchString);
     free(r);
 }
 
-void freeData(struct data *d){
-    if(! d){
-        return;
-    }
-    if (d->PFI){
-        free(d->PFI);
-    }
-    if (d->EZI_ADD){
-        free(d->EZI_ADD);
-    }
-    if (d->SRC_VERIF){
-        free(d->SRC_VERIF);
-    }
-    if (d->PROPSTATUS){
-        free(d->PROPSTATUS);
-    }
-    if (d->GCODEFEAT){
-        free(d->GCODEFEAT);
-    }
-    if (d->LOC_DESC){
-        free(d->LOC_DESC);
-    }
-    if (d->BLGUNTTYP){
-        free(d->BLGUNTTYP);
-    }
-    if (d->HSAUNITID){
-        free(d->HSAUNITID);
-    }
-    if (d->BUNIT_PRE1){
-        free(d->BUNIT_PRE1);
-    }
-    if (d->BUNIT_ID1){
-        free(d->BUNIT_ID1);
-    }
-    if (d->BUNIT_SUF1){
-        free(d->BUNIT_SUF1);
-    }
-    if (d->BUNIT_PRE2){
-        free(d->BUNIT_PRE2);
-    }
-    if (d->BUNIT_ID2){
-        free(d->BUNIT_ID2);
-    }
-    if (d->BUNIT_SUF2){
-        free(d->BUNIT_SUF2);
-    }
-    if (d->FLOOR_TYPE){
-        free(d->FLOOR_TYPE);
+/* Free the interned values of low-cardinality fields. */
+void freeFieldEncodings(){
+    freeInterned();
+}
+
+/* Free the indices built by searchClosestDouble, so they are built again. */
+static void freeIndices(struct dictionary *dict){
+    if(dict->indices){
+        for(int i = 0; i < NUM_FIELDS; i++){
+            if(dict->indices[i]){
+                if(dict->indices[i]->ids){
+                    free(dict->indices[i]->ids);
+                }
+                free(dict->indices[i]);
+            }
+        }
+        free(dict->indices);
+        dict->indices = NULL;
     }
-    if (d->FLOOR_NO_1){
-        free(d->FLOOR_NO_1);
+}
+
+/* Free a given dictionary. */
+void freeDict(struct dictionary *dict){
+    if(! dict){
+        return;
     }
-    if (d->FLOOR_NO_2){
-        free(d->FLOOR_NO_2);
+    freeRecordStore(dict->store);
+    freeIndices(dict);
+    free(dict);
+}
+
+/* Names of the COLUMN_ kinds, for memory reports. */
+static char *columnKindNames[COLUMN_KINDS] = {
+    "string", "coded", "int", "number", "double"
+};
+
+/* Write the memory held by a record store. */
+static void printStoreMemory(FILE *f, struct recordStore *store){
+    struct storeMemory m;
+    storeMemoryStats(store, &m);
+    fprintf(f, "Record store: %u records (%u retired)%s\n", m.records, m.retired,
+        m.mapped ? ", mapped from the snapshot" : "");
+    uint64_t columnTotal = 0;
+    for(int i = 0; i < COLUMN_KINDS; i++){
+        columnTotal += m.columnBytes[i];
+    }
+    fprintf(f, "  columns      %12llu bytes (", 
+        (unsigned long long) (columnTotal + m.columnUnused));
+    for(int i = 0; i < COLUMN_KINDS; i++){
+        fprintf(f, "%s%s %llu", i ? ", " : "", columnKindNames[i],
+            (unsigned long long) m.columnBytes[i]);
+    }
+    fprintf(f, "), %llu unused, %llu coded values\n",
+        (unsigned long long) m.columnUnused, (unsigned long long) m.codedValues);
+    fprintf(f, "  heap         %12llu bytes, %llu unused\n",
+        (unsigned long long) m.heapBytes, (unsigned long long) m.heapUnused);
+    fprintf(f, "  exceptions   %12llu bytes in %u exceptions, %llu unused\n",
+        (unsigned long long) m.exceptionBytes, m.exceptions,
+        (unsigned long long) m.exceptionUnused);
+    fprintf(f, "  PFI index    %12llu bytes\n", (unsigned long long) m.indexBytes);
+    if(storeIsLazy(store)){
+        fprintf(f, "  lazy rows    %12llu bytes, %llu rows cached\n",
+            (unsigned long long) m.lazyBytes, (unsigned long long) m.cachedRows);
     }
-    if (d->BUILDING){
-        free(d->BUILDING);
+}
+
+/* Write where the dictionary's memory goes. */
+void printMemoryReport(struct dictionary *dict, FILE *f){
+    printStoreMemory(f, dict->store);
+    uint64_t indexBytes = 0;
+    int indexCount = 0;
+    for(int i = 0; dict->indices && i < NUM_FIELDS; i++){
+        if(dict->indices[i]){
+            indexBytes += sizeof(recordId) * dict->indices[i]->valueCount;
+            indexCount++;
+        }
     }
-    if (d->COMPLEX){
-        free(d->COMPLEX);
+    fprintf(f, "Double indices: %llu bytes in %d indices\n", 
+        (unsigned long long) indexBytes, indexCount);
+}
+
+/* Called for each change applied to a store, with the record it retired and
+    the record it added, either of which may be STORE_NO_RECORD. */
+typedef void (*changeApplier)(void *dict, recordId retired, recordId added);
+
+/* Read a change file, adding and retiring records of the store by PFI and 
+    passing each change on to apply (if given). A row with the wrong number
+    of fields, or a file which can't be read to the end, is reported and 
+    stops the file, with the changes before it already applied. */
+static int applyChanges(struct recordStore *store, const char *filename,
+    changeApplier apply, void *dict){
+    struct csvReader *reader = openCSV(filename);
+    if(! reader){
+        return -1;
+    }
+    int changes = 0;
+    int row = 0;
+    int fieldCount;
+    struct csvField fields[DELTA_FIELDS];
+    while((fieldCount = nextCSVRow(reader, fields, DELTA_FIELDS)) > 0){
+        row++;
+        if(fieldCount != DELTA_FIELDS){
+            fprintf(stderr, "%s: row %d has %d fields, expected %d\n", filename,
+                row, fieldCount, DELTA_FIELDS);
+            closeCSV(reader);
+            return -1;
+        }
+        struct csvField *recordFields = fields + 1;
+        char change[fields[0].length + 1];
+        change[csvFieldDecode(reader, &fields[0], change)] = '\0';
+        char pfi[recordFields[STORE_PFI_FIELD].length + 1];
+        size_t pfiLength = csvFieldDecode(reader, &recordFields[STORE_PFI_FIELD],
+            pfi);
+
+        recordId retired = storeFindPfi(store, pfi, pfiLength);
+        recordId added = STORE_NO_RECORD;
+        if(strcmp(change, CHANGE_ADD) == 0 || strcmp(change, CHANGE_UPDATE) == 0){
+            /* Adding a PFI already present replaces it, updating one which
+                isn't adds it. */
+            added = storeAddFields(store, reader, recordFields, NUM_FIELDS);
+        } else if(strcmp(change, CHANGE_RETIRE) != 0){
+            fprintf(stderr, "%s: unknown change %s for PFI %s\n", filename,
+                change, pfi);
+            continue;
+        }
+        if(retired != STORE_NO_RECORD){
+            storeRetire(store, retired);
+        }
+        if(apply && (retired != STORE_NO_RECORD || added != STORE_NO_RECORD)){
+            apply(dict, retired, added);
+        }
+        changes++;
     }
-    if (d->HSE_PREF1){
-        free(d->HSE_PREF1);
+    closeCSV(reader);
+    if(fieldCount < 0){
+        fprintf(stderr, "%s: could not be read after row %d\n", filename, row);
+        return -1;
     }
-    if (d->HSE_NUM1){
-        free(d->HSE_NUM1);
+    return changes;
+}
+
+/* Apply a change file to the dictionary in place. */
+int applyDelta(struct dictionary *dict, const char *filename){
+    if(storeIsShared(dict->store)){
+        /* The other holder would miss the changes. */
+        return -1;
     }
-    if (d->HSE_SUF1){
-        free(d->HSE_SUF1);
+    int changes = applyChanges(dict->store, filename, NULL, NULL);
+    /* Indices are sorted over the old records. */
+    freeIndices(dict);
+    return changes;
+}
+
+/* Patricia Trie specific functions for Stage 2 */
+
+/* Returns the key of a record in the store, which trie labels are held in. */
+static const char *patriciaKey(void *store, recordId id){
+    unsigned int keyLength;
+    return storeKey((struct recordStore *) store, id, &keyLength);
+}
+
+/* Create a Patricia Trie dictionary around the given store. */
+static struct patriciaDict *newPatriciaDictWithStore(struct recordStore *store){
+    struct patriciaDict *dict = (struct patriciaDict *) 
+        malloc(sizeof(struct patriciaDict));
+    assert(dict);
+    dict->tree = pt_create(patriciaKey, store);
+    dict->critbit = NULL;
+    dict->snapshot = NULL;
+    dict->store = store;
+    dict->loading = 0;
+    return dict;
+}
+
+/* Create a new Patricia Trie dictionary. */
+struct patriciaDict *newPatriciaDict(){
+    return newPatriciaDictWithStore(newRecordStore());
+}
+
+/* Index a record newly added to the store under its key. */
+static void insertPatriciaId(struct patriciaDict *dict, recordId id){
+    if(dict->loading){
+        return;
     }
-    if (d->HSE_PREF2){
-        free(d->HSE_PREF2);
+    unsigned int keyLength;
+    const char *key = storeKey(dict->store, id, &keyLength);  // EZI_ADD field
+    if(dict->critbit){
+        cb_insert(dict->critbit, key, keyLength, id);
+    } else {
+        assert(dict->tree);
+        pt_insert(dict->tree, key, keyLength, id);
     }
-    if (d->HSE_NUM2){
-        free(d->HSE_NUM2);
+}
+
+/* Index every live record of the store in an empty trie at once, on up to 
+    numThreads threads. */
+static void indexPatriciaStore(struct patriciaDict *dict, int numThreads){
+    uint32_t recordCount = storeRecordCount(dict->store);
+    if(dict->critbit){
+        for(recordId id = 0; id < recordCount; id++){
+            if(! storeIsRetired(dict->store, id)){
+                insertPatriciaId(dict, id);
+            }
+        }
+        return;
     }
-    if (d->HSE_SUF2){
-        free(d->HSE_SUF2);
+    
+    const char **keys = (const char **) malloc(sizeof(char *) * recordCount);
+    size_t *keyLengths = (size_t *) malloc(sizeof(size_t) * recordCount);
+    recordId *ids = (recordId *) malloc(sizeof(recordId) * recordCount);
+    assert(keys && keyLengths && ids);
+    size_t n = 0;
+    for(recordId id = 0; id < recordCount; id++){
+        if(! storeIsRetired(dict->store, id)){
+            unsigned int keyLength;
+            keys[n] = storeKey(dict->store, id, &keyLength);
+            keyLengths[n] = keyLength;
+            ids[n++] = id;
+        }
     }
-    if (d->DISP_NUM1){
-        free(d->DISP_NUM1);
+    pt_bulk_load_parallel(dict->tree, keys, keyLengths, ids, n, numThreads);
+    free(keys);
+    free(keyLengths);
+    free(ids);
+}
+
+/* Index every record of a dictionary in a trie over the same store. */
+struct patriciaDict *newPatriciaDictFromDict(struct dictionary *dict){
+    struct patriciaDict *ret = newPatriciaDictWithStore(storeShare(dict->store));
+    indexPatriciaStore(ret, 1);
+    return ret;
+}
+
+void startPatriciaLoad(struct patriciaDict *dict){
+    assert(dict->critbit || dict->tree->root->child_count == 0);
+    dict->loading = 1;
+}
+
+void finishPatriciaLoad(struct patriciaDict *dict, int numThreads){
+    assert(dict->loading);
+    dict->loading = 0;
+    indexPatriciaStore(dict, numThreads);
+}
+
+/* Index the records of an empty dictionary in a crit-bit trie instead. */
+void usePatriciaCritBit(struct patriciaDict *dict){
+    assert(dict->tree && dict->tree->root->child_count == 0);
+    pt_free(dict->tree);
+    dict->tree = NULL;
+    dict->critbit = cb_create(patriciaKey, dict->store);
+}
+
+/* Create a new Patricia Trie dictionary of lazily decoded records. */
+struct patriciaDict *newLazyPatriciaDict(struct csvReader *reader, 
+    int cacheRows){
+    return newPatriciaDictWithStore(newLazyRecordStore(reader, cacheRows));
+}
+
+/* Open a snapshot, which is searched where it is mapped. */
+struct patriciaDict *openPatriciaSnapshot(const char *filename, int *version){
+    pt_snapshot_t *snapshot = pt_snapshot_open(filename, version);
+    if(! snapshot){
+        return NULL;
     }
-    if (d->ROAD_NAME){
-        free(d->ROAD_NAME);
+    struct patriciaDict *dict = (struct patriciaDict *) 
+        malloc(sizeof(struct patriciaDict));
+    assert(dict);
+    dict->tree = NULL;
+    dict->critbit = NULL;
+    dict->snapshot = snapshot;
+    dict->store = snapshot->store;
+    dict->loading = 0;
+    return dict;
+}
+
+/* Save the trie and its store as a snapshot. */
+int savePatriciaSnapshot(struct patriciaDict *dict, const char *filename){
+    if(! dict->tree){
+        /* Snapshots are laid out as the trie's nodes. */
+        return -1;
     }
-    if (d->ROAD_TYPE){
-        free(d->ROAD_TYPE);
+    return pt_snapshot_save(dict->tree, dict->store, filename);
+}
+
+int freezePatriciaDict(struct patriciaDict *dict){
+    if(! dict->tree){
+        return -1;
     }
-    if (d->RD_SUF){
-        free(d->RD_SUF);
+    dict->snapshot = pt_freeze(dict->tree, dict->store);
+    pt_free(dict->tree);
+    dict->tree = NULL;
+    /* The frozen trie holds the store now, and frees it with itself. */
+    freeRecordStore(dict->store);
+    return 0;
+}
+
+/* Insert the fields of a mapped CSV row into the Patricia Trie dictionary. */
+void insertPatriciaFields(struct patriciaDict *dict, struct csvReader *reader,
+    struct csvField *fields, int fieldCount){
+    if(!dict){
+        return;
     }
-    if (d->LOCALITY){
-        free(d->LOCALITY);
+    insertPatriciaId(dict, storeAddFields(dict->store, reader, fields, 
+        fieldCount));
+}
+
+/* Insert an already decoded row into the Patricia Trie dictionary. */
+void insertPatriciaRow(struct patriciaDict *dict, a2_data *row){
+    if(!dict || !row){
+        return;
     }
-    if (d->STATE){
-        free(d->STATE);
+    insertPatriciaId(dict, storeAddRow(dict->store, row));
+}
+
+/* Move a changed record within the trie. */
+static void applyPatriciaChange(void *d, recordId retired, recordId added){
+    struct patriciaDict *dict = (struct patriciaDict *) d;
+    if(dict->tree && retired != STORE_NO_RECORD && added != STORE_NO_RECORD){
+        /* A corrected record, which may have moved to another key. */
+        unsigned int keyLength, newKeyLength;
+        const char *key = storeKey(dict->store, retired, &keyLength);
+        const char *newKey = storeKey(dict->store, added, &newKeyLength);
+        bool updated = pt_update(dict->tree, key, retired, newKey, newKeyLength,
+            added);
+        assert(updated);
+        return;
     }
-    if (d->POSTCODE){
-        free(d->POSTCODE);
+    if(retired != STORE_NO_RECORD){
+        unsigned int keyLength;
+        const char *key = storeKey(dict->store, retired, &keyLength);
+        bool removed;
+        if(dict->critbit){
+            removed = cb_remove_record(dict->critbit, key, retired);
+        } else {
+            removed = pt_remove_record(dict->tree, key, retired);
+        }
+        assert(removed);
     }
-    if (d->ACCESSTYPE){
-        free(d->ACCESSTYPE);
+    if(added != STORE_NO_RECORD){
+        insertPatriciaId(dict, added);
     }
-    free(d);
 }
 
-/* Free a given dictionary. */
-void freeDict(struct dictionary *dict){
-    if(! dict){
-        return;
+/* Apply a change file to the Patricia Trie dictionary in place. */
+int applyPatriciaDelta(struct patriciaDict *dict, const char *filename){
+    if(dict->snapshot || storeIsLazy(dict->store)){
+        /* Neither has a store records can be added to. */
+        return -1;
     }
-    struct dictionaryNode *current = dict->head;
-    struct dictionaryNode *next;
-    while(current){
-        next = current->next;
-        freeData(current->record);
-        free(current);
-        current = next;
+    if(storeIsShared(dict->store)){
+        /* The other holder would miss the changes. */
+        return -1;
     }
-    if(dict->indices){
-        for(int i = 0; i < NUM_FIELDS; i++){
-            if(dict->indices[i]){
-                if(dict->indices[i]->nodes){
-                    free(dict->indices[i]->nodes);
-                }
-                free(dict->indices[i]);
-            }
+    return applyChanges(dict->store, filename, applyPatriciaChange, dict);
+}
+
+/* Point the result at the records of a key, which stay in the trie. */
+static void setPatriciaRecords(struct queryResult *result, 
+    const record_vec_t *records){
+    result->numRecords = (int) records->count;
+    result->records = pt_record_ids(records);
+}
+
+/* Point the result at the records of a snapshot node. */
+static void setSnapshotRecords(struct queryResult *result, pt_snapshot_t *snapshot,
+    uint32_t node){
+    result->numRecords = (int) pt_snapshot_record_count(snapshot, node);
+    result->records = snapshot->records + snapshot->nodes[node].first_record;
+}
+
+/* Search a mapped snapshot or frozen trie, in the same way as the trie. */
+static void lookupSnapshot(struct queryResult *result, pt_snapshot_t *snapshot,
+    char *query){
+    bool exact = false;
+    uint32_t m = pt_snapshot_search_with_mismatch(snapshot, query, &exact);
+
+    if(exact){
+        setSnapshotRecords(result, snapshot, m);
+    } else {
+        /* No exact match - use the most similar key instead. */
+        uint32_t best = pt_snapshot_search_similar_under(snapshot, m, query, NULL);
+        if(best != PT_SNAPSHOT_NONE){
+            setSnapshotRecords(result, snapshot, best);
         }
-        free(dict->indices);
     }
-    free(dict);
 }
 
-/* Patricia Trie specific functions for Stage 2 */
-
-/* Create a new Patricia Trie dictionary. */
-ptree_t *newPatriciaDict(){
-    return pt_create();
+/* Point the result at the records of a crit-bit leaf. Every record of the
+    empty key shares its leaf, where the trie makes each a key of its own and
+    only finds the first, so only the first is found here as well. */
+static void setCritBitRecords(struct queryResult *result, cbtree_t *critbit,
+    const record_vec_t *records){
+    setPatriciaRecords(result, records);
+    if(result->numRecords > 1 
+        && critbit->key(critbit->key_ud, result->records[0])[0] == '\0'){
+        result->numRecords = 1;
+    }
 }
 
-/* Insert a record into the Patricia Trie dictionary. */
-void insertPatriciaRecord(ptree_t *dict, a2_data *record, const char *key){
-    if(!dict || !record || !key){
-        return;
+/* Search a crit-bit trie, in the same way as the trie. */
+static void lookupCritBit(struct queryResult *result, cbtree_t *critbit,
+    char *query){
+    bool exact = false;
+    size_t keyStart;
+    cb_handle_t m = cb_search_with_mismatch(critbit, query, &exact, &keyStart);
+
+    if(exact){
+        setCritBitRecords(result, critbit, &cb_leaf(critbit, m)->records);
+    } else {
+        /* No exact match - use the most similar key instead. */
+        const record_vec_t *best = cb_search_similar_under(critbit, m, keyStart,
+            query, NULL);
+        if(best){
+            setCritBitRecords(result, critbit, best);
+        }
     }
-    pt_insert(dict, key, (struct data*)record);
 }
 
 /* Search for records in Patricia Trie with exact and approximate matching. */
-struct queryResult *lookupPatriciaRecord(ptree_t *dict, char *query){
+struct queryResult *lookupPatriciaRecord(struct patriciaDict *dict, char *query){
     if(!dict || !query){
         return NULL;
     }
@@ -967,67 +872,39 @@ struct queryResult *lookupPatriciaRecord(ptree_t *dict, char *query){
     result->searchString = strdup(query);
     result->numRecords = 0;
     result->records = NULL;
-    result->a2_records = NULL;
+    result->ownsRecords = 0;
+    result->store = dict->store;
     result->bitCount = 0;
     result->nodeCount = 0;
     result->stringCount = 0;
-    result->isPatriciaResult = 1;
     
     /* Reset performance metrics for this query */
     metrics_reset();
     
-    /* Search for the query in the Patricia Trie */
-    bool exact = false;
-    pt_node_t *m = pt_search_with_mismatch(dict, query, &exact);
-    
-    /* Check if we found an exact match */
-    if(m && exact && m->is_terminal){
-        /* Exact match found - count records and allocate array */
-        record_list_t *p = m->records;
-        while(p){
-            result->numRecords++;
-            p = p->next;
-        }
-        
-        if(result->numRecords > 0){
-            result->a2_records = (a2_data**)malloc(sizeof(a2_data*) * result->numRecords);
-            assert(result->a2_records);
-            
-            int i = 0;
-            p = m->records;
-            while(p){
-                result->a2_records[i] = (a2_data*)p->rec;
-                i++;
-                p = p->next;
-            }
-        }
+    if(dict->snapshot){
+        lookupSnapshot(result, dict->snapshot, query);
+    } else if(dict->critbit){
+        lookupCritBit(result, dict->critbit, query);
     } else {
-        /* No exact match - find the most similar key using edit distance */
-        char *best_key = NULL;
-        record_list_t *best = pt_search_similar_under(m, query, &best_key);
+        /* Search for the query in the Patricia Trie */
+        bool exact = false;
+        size_t keyStart;
+        pt_node_t *m = pt_search_with_mismatch(dict->tree, query, &exact, &keyStart);
         
-        if(best && best_key){
-            /* Accept all similar matches found by the Patricia Trie */
-            /* Similar match found - count records and allocate array */
-            record_list_t *p = best;
-            while(p){
-                result->numRecords++;
-                p = p->next;
-            }
+        /* Check if we found an exact match */
+        if(m && exact && m->is_terminal){
+            setPatriciaRecords(result, &m->records);
+        } else {
+            /* No exact match - find the most similar key using edit distance */
+            char *best_key = NULL;
+            const record_vec_t *best = pt_search_similar_under(dict->tree, m, keyStart, query,
+                &best_key);
             
-            if(result->numRecords > 0){
-                result->a2_records = (a2_data**)malloc(sizeof(a2_data*) * result->numRecords);
-                assert(result->a2_records);
-                
-                int i = 0;
-                p = best;
-                while(p){
-                    result->a2_records[i] = (a2_data*)p->rec;
-                    i++;
-                    p = p->next;
-                }
+            if(best && best_key){
+                /* Accept all similar matches found by the Patricia Trie */
+                setPatriciaRecords(result, best);
+                free(best_key);
             }
-            free(best_key);
         }
     }
     
@@ -1039,10 +916,96 @@ struct queryResult *lookupPatriciaRecord(ptree_t *dict, char *query){
     return result;
 }
 
-/* Free a Patricia Trie dictionary. */
-void freePatriciaDict(ptree_t *dict){
-    if(dict){
-        pt_free(dict);
+/* Write the memory held by a crit-bit trie. */
+static void printCritBitMemory(FILE *f, cbtree_t *critbit){
+    cb_memory_stats_t m;
+    cb_memory_stats(critbit, &m);
+    fprintf(f, "Crit-bit trie: %llu internal nodes, %llu leaves, max depth %llu\n",
+        (unsigned long long) m.internals, (unsigned long long) m.leaves,
+        (unsigned long long) m.max_depth);
+    fprintf(f, "  nodes        %12llu bytes (internal %llu, leaves %llu), %llu unused\n",
+        (unsigned long long) (m.internal_bytes + m.leaf_bytes),
+        (unsigned long long) m.internal_bytes, (unsigned long long) m.leaf_bytes,
+        (unsigned long long) m.unused);
+    fprintf(f, "  record ids   %12llu bytes in %llu allocations (%llu of %llu ids inline)\n",
+        (unsigned long long) m.arena.bytes, (unsigned long long) m.arena.allocations,
+        (unsigned long long) m.inline_records, (unsigned long long) m.records);
+}
+
+/* Write where the Patricia Trie dictionary's memory goes. */
+void printPatriciaMemoryReport(struct patriciaDict *dict, FILE *f){
+    printStoreMemory(f, dict->store);
+    if(dict->snapshot){
+        fprintf(f, "%s: %u nodes and %u record ids, %llu bytes %s\n",
+            dict->snapshot->frozen ? "Frozen trie" : "Snapshot",
+            dict->snapshot->node_count, dict->snapshot->record_count,
+            (unsigned long long) dict->snapshot->map_size,
+            dict->snapshot->frozen ? "held" : "mapped");
+        return;
+    }
+    if(dict->critbit){
+        printCritBitMemory(f, dict->critbit);
+        return;
     }
+
+    pt_memory_stats_t m;
+    pt_memory_stats(dict->tree, &m);
+    uint64_t internal = m.nodes - m.leaves;
+    fprintf(f, "Patricia Trie: %llu nodes (%llu terminal, %llu leaves), "
+        "average fanout %.2f, max %llu\n", (unsigned long long) m.nodes,
+        (unsigned long long) m.terminals, (unsigned long long) m.leaves,
+        internal ? (double) (m.nodes - 1) / internal : 0.0,
+        (unsigned long long) m.max_fanout);
+    fprintf(f, "  node slabs   %12llu bytes in %llu slabs, %llu unused\n",
+        (unsigned long long) m.slab_bytes, (unsigned long long) m.slab_count,
+        (unsigned long long) m.slab_unused);
+    fprintf(f, "  labels       %12llu characters, average length %.2f, %llu held in "
+        "the node\n", (unsigned long long) m.label_chars, (double) m.label_chars / m.nodes,
+        (unsigned long long) m.inline_labels);
+    fprintf(f, "  child array  %12llu bytes, %llu in lookups, %llu unused "
+        "(Node4 %llu, Node16 %llu, Node48 %llu, Node256 %llu)\n",
+        (unsigned long long) m.child_bytes, (unsigned long long) m.lookup_bytes,
+        (unsigned long long) m.child_unused, (unsigned long long) m.node_kinds[0],
+        (unsigned long long) m.node_kinds[1], (unsigned long long) m.node_kinds[2],
+        (unsigned long long) m.node_kinds[3]);
+    fprintf(f, "  record ids   %12llu bytes in %llu spilled arrays, %llu unused "
+        "(%llu of %llu ids inline)\n", (unsigned long long) m.spilled_bytes,
+        (unsigned long long) m.spilled_arrays, (unsigned long long) m.spilled_unused,
+        (unsigned long long) m.inline_records, (unsigned long long) m.records);
+    fprintf(f, "  arena        %12llu bytes in %llu allocations",
+        (unsigned long long) m.arena.bytes, (unsigned long long) m.arena.allocations);
+    if(m.arena.blocks){
+        fprintf(f, ", %llu bytes mapped in %llu blocks", 
+            (unsigned long long) m.arena.mapped, (unsigned long long) m.arena.blocks);
+    }
+    fprintf(f, "\n  label lengths");
+    for(int i = 0; i < PT_LABEL_BUCKETS; i++){
+        unsigned long low = i ? 1UL << (i - 1) : 0;
+        unsigned long high = i ? (1UL << i) - 1 : 0;
+        if(i == PT_LABEL_BUCKETS - 1){
+            fprintf(f, " %lu+: %llu", low, (unsigned long long) m.label_lengths[i]);
+        } else if(low == high){
+            fprintf(f, " %lu: %llu", low, (unsigned long long) m.label_lengths[i]);
+        } else {
+            fprintf(f, " %lu-%lu: %llu", low, high, 
+                (unsigned long long) m.label_lengths[i]);
+        }
+    }
+    fprintf(f, "\n");
 }
 
+/* Free a Patricia Trie dictionary. */
+void freePatriciaDict(struct patriciaDict *dict){
+    if(! dict){
+        return;
+    }
+    pt_free(dict->tree);
+    cb_free(dict->critbit);
+    if(dict->snapshot){
+        /* The snapshot's store goes with it. */
+        pt_snapshot_close(dict->snapshot);
+    } else {
+        freeRecordStore(dict->store);
+    }
+    free(dict);
+}
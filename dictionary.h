@@ -3,9 +3,9 @@
     dictionary module intended to allow lookup
     for particular values.
 */
-#include "record_struct.h"
-#include "patricia.h"
+#include "read.h"
 #include "a2data.h"
+#include "recstore.h"
 #include <stdio.h>
 
 #define LOOKUPSTAGE 1
@@ -20,8 +20,23 @@ struct dictionary;
 /* Returns an empty dictionary. */
 struct dictionary *newDict();
 
-/* Insert a given record into the dictionary. */
-void insertRecord(struct dictionary *dict, struct csvRecord *record);
+/* Insert the fields of a mapped CSV row into the dictionary. */
+void insertRecordFields(struct dictionary *dict, struct csvReader *reader,
+    struct csvField *fields, int fieldCount);
+
+/* Insert a row already decoded (for example by a2_from_csvFields on another
+    thread) into the dictionary. The caller still owns the row. */
+void insertRow(struct dictionary *dict, a2_data *row);
+
+/* Apply a change file to the dictionary in place. The file has a header row,
+    then each row is a CHANGE column (ADD, UPDATE or RETIRE) followed by the
+    fields of a record. Records are matched on PFI: adding or updating 
+    replaces any record with the same PFI, retiring removes it. Returns the 
+    number of changes applied, or -1 if the file can't be opened, a row has
+    the wrong number of fields or the file can't be read to the end (the rows
+    before are still applied), or the records are shared with a Patricia Trie
+    dictionary. */
+int applyDelta(struct dictionary *dict, const char *filename);
 
 /* Search for a given key in the dictionary. */
 struct queryResult *lookupRecord(struct dictionary *dict, char *query);
@@ -42,26 +57,89 @@ struct queryResult *searchClosestDouble(struct dictionary *dict, char *query,
 void printQueryResult(struct queryResult *r, FILE *summaryFile, 
     FILE *outputFile, int stage);
 
+/* Write a report of the memory held by the dictionary to f. */
+void printMemoryReport(struct dictionary *dict, FILE *f);
+
 /* Free the given query result. */
 void freeQueryResult(struct queryResult *r);
 
 /* Free a given dictionary. */
 void freeDict(struct dictionary *dict);
 
+/* Free the shared values of low-cardinality fields, once every dictionary
+    and record using them has been freed. */
+void freeFieldEncodings();
+
 /* Patricia Trie specific functions for Stage 2 */
 
-/* Create a new Patricia Trie dictionary. */
-ptree_t *newPatriciaDict();
+/* Patricia Trie dictionary, the trie (or a mapped snapshot of it) and the
+    store holding its records. */
+struct patriciaDict;
 
-/* Insert a record into the Patricia Trie dictionary. */
-void insertPatriciaRecord(ptree_t *dict, a2_data *record, const char *key);
+/* Create a new Patricia Trie dictionary. */
+struct patriciaDict *newPatriciaDict();
+
+/* Create a Patricia Trie dictionary over the records of the given 
+    dictionary, which share one store rather than being copied. Either may be
+    freed first, the records go with the last. */
+struct patriciaDict *newPatriciaDictFromDict(struct dictionary *dict);
+
+/* Create a new Patricia Trie dictionary which only holds the key of each 
+    record, decoding the rest from the reader's mapped data when needed. The
+    dictionary takes ownership of the reader, see newLazyRecordStore. */
+struct patriciaDict *newLazyPatriciaDict(struct csvReader *reader, 
+    int cacheRows);
+
+/* Index the records of an empty Patricia Trie dictionary in a crit-bit 
+    trie (see critbit.h) rather than the character trie. Lookups find the 
+    same records, only the comparisons counted differ. Crit-bit dictionaries
+    can't be saved as snapshots. */
+void usePatriciaCritBit(struct patriciaDict *dict);
+
+/* Stop indexing records as they are inserted into an empty Patricia Trie
+    dictionary, until finishPatriciaLoad builds the trie from all of them at 
+    once on up to numThreads threads (see pt_bulk_load_parallel). The trie is
+    the same as if they had been indexed one by one. */
+void startPatriciaLoad(struct patriciaDict *dict);
+void finishPatriciaLoad(struct patriciaDict *dict, int numThreads);
+
+/* Open a Patricia Trie dictionary saved as a snapshot. Returns NULL if the
+    file isn't a snapshot, with *version set to -1, or if it is one which
+    can't be used, with *version set to the version it was saved as (see 
+    pt_snapshot_open). */
+struct patriciaDict *openPatriciaSnapshot(const char *filename, int *version);
+
+/* Save a Patricia Trie dictionary as a snapshot. Returns 0 on success, or
+    -1 if it can't be written or the dictionary isn't a character trie. */
+int savePatriciaSnapshot(struct patriciaDict *dict, const char *filename);
+
+/* Freeze the trie of a Patricia Trie dictionary into the compact layout of
+    a snapshot, held in memory, which is searched in the same way. The 
+    dictionary can't be changed or saved as a snapshot afterwards. Returns 0
+    on success, or -1 if it has no trie to freeze. */
+int freezePatriciaDict(struct patriciaDict *dict);
+
+/* Insert the fields of a mapped CSV row into the Patricia Trie dictionary. */
+void insertPatriciaFields(struct patriciaDict *dict, struct csvReader *reader,
+    struct csvField *fields, int fieldCount);
+
+/* Insert an already decoded row into the Patricia Trie dictionary. The 
+    caller still owns the row. */
+void insertPatriciaRow(struct patriciaDict *dict, a2_data *row);
+
+/* Apply a change file to the Patricia Trie dictionary in place, see 
+    applyDelta. Returns -1 for snapshots, lazily decoded dictionaries and
+    those sharing their records, which can't be changed. */
+int applyPatriciaDelta(struct patriciaDict *dict, const char *filename);
 
 /* Search for records in Patricia Trie with exact and approximate matching. */
-struct queryResult *lookupPatriciaRecord(ptree_t *dict, char *query);
+struct queryResult *lookupPatriciaRecord(struct patriciaDict *dict, 
+    char *query);
 
-/* Free a Patricia Trie dictionary. */
-void freePatriciaDict(ptree_t *dict);
+/* Write a report of the memory held by the Patricia Trie dictionary to f,
+    by category along with the shape of the trie. */
+void printPatriciaMemoryReport(struct patriciaDict *dict, FILE *f);
 
-/* Print a single field of an a2_data record. */
-void printA2Field(FILE *f, a2_data *record, int fieldIndex);
+/* Free a Patricia Trie dictionary. */
+void freePatriciaDict(struct patriciaDict *dict);
 
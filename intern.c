@@ -0,0 +1,228 @@
+/*
+    Data structure and function implementations for a string interning
+    module.
+*/
+#include "intern.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#define INIT_SLOTS 64
+#define VALUE_BLOCK 256
+#define CHUNK_BYTES (1 << 16)
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+/* A hash table entry, empty when value is NULL. */
+struct internSlot {
+    uint64_t hash;
+    const char *value;
+    size_t length;
+    columnCode code;
+};
+
+/* Open addressing hash table of strings. */
+struct internTable {
+    struct internSlot *slots;
+    size_t capacity;
+    size_t count;
+};
+
+/* Block of storage for interned strings. */
+struct internChunk {
+    struct internChunk *next;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
+/* A coded value of a column. */
+struct columnValue {
+    const char *value;
+    size_t length;
+};
+
+/* Values are held by code in blocks which are never moved or freed before 
+    the dictionary, so they can be read without the lock. */
+struct columnDict {
+    pthread_mutex_t lock;
+    struct internTable table;
+    struct columnValue *blocks[(MAX_COLUMN_CODES + VALUE_BLOCK - 1) / VALUE_BLOCK];
+    int valueCount;
+};
+
+/* The global pool. */
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static struct internTable pool;
+static struct internChunk *chunks;
+
+static uint64_t hashBytes(const char *s, size_t len){
+    uint64_t hash = FNV_OFFSET;
+    for(size_t i = 0; i < len; i++){
+        hash ^= (unsigned char) s[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+/* Returns the slot holding the string, or the empty slot it belongs in. */
+static struct internSlot *findSlot(struct internTable *table, const char *s,
+    size_t len, uint64_t hash){
+    size_t mask = table->capacity - 1;
+    size_t i = hash & mask;
+    while(table->slots[i].value){
+        struct internSlot *slot = &table->slots[i];
+        if(slot->hash == hash && slot->length == len
+            && memcmp(slot->value, s, len) == 0){
+            return slot;
+        }
+        i = (i + 1) & mask;
+    }
+    return &table->slots[i];
+}
+
+/* Makes sure the table has room for one more string. */
+static void reserveSlot(struct internTable *table){
+    if(table->capacity && (table->count + 1) * 2 <= table->capacity){
+        return;
+    }
+    struct internTable grown;
+    grown.capacity = table->capacity ? table->capacity * 2 : INIT_SLOTS;
+    grown.count = table->count;
+    grown.slots = (struct internSlot *) calloc(grown.capacity,
+        sizeof(struct internSlot));
+    assert(grown.slots);
+    for(size_t i = 0; i < table->capacity; i++){
+        struct internSlot *slot = &table->slots[i];
+        if(slot->value){
+            *findSlot(&grown, slot->value, slot->length, slot->hash) = *slot;
+        }
+    }
+    free(table->slots);
+    *table = grown;
+}
+
+/* Copies a string into chunk storage. */
+static const char *storeString(const char *s, size_t len){
+    if(! chunks || chunks->size - chunks->used < len + 1){
+        size_t size = CHUNK_BYTES;
+        if(len + 1 > size){
+            size = len + 1;
+        }
+        struct internChunk *chunk = (struct internChunk *)
+            malloc(sizeof(struct internChunk) + size);
+        assert(chunk);
+        chunk->used = 0;
+        chunk->size = size;
+        chunk->next = chunks;
+        chunks = chunk;
+    }
+    char *copy = chunks->data + chunks->used;
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    chunks->used += len + 1;
+    return copy;
+}
+
+/* Returns the pool's copy of a string, the pool lock must be held. */
+static const char *internLocked(const char *s, size_t len, uint64_t hash){
+    reserveSlot(&pool);
+    struct internSlot *slot = findSlot(&pool, s, len, hash);
+    if(! slot->value){
+        slot->hash = hash;
+        slot->value = storeString(s, len);
+        slot->length = len;
+        pool.count++;
+    }
+    return slot->value;
+}
+
+const char *internString(const char *s, size_t len){
+    uint64_t hash = hashBytes(s, len);
+    pthread_mutex_lock(&poolLock);
+    const char *value = internLocked(s, len, hash);
+    pthread_mutex_unlock(&poolLock);
+    return value;
+}
+
+void freeInterned(){
+    pthread_mutex_lock(&poolLock);
+    while(chunks){
+        struct internChunk *next = chunks->next;
+        free(chunks);
+        chunks = next;
+    }
+    free(pool.slots);
+    pool.slots = NULL;
+    pool.capacity = 0;
+    pool.count = 0;
+    pthread_mutex_unlock(&poolLock);
+}
+
+struct columnDict *newColumnDict(){
+    struct columnDict *dict = (struct columnDict *)
+        calloc(1, sizeof(struct columnDict));
+    assert(dict);
+    pthread_mutex_init(&dict->lock, NULL);
+    return dict;
+}
+
+columnCode columnEncode(struct columnDict *dict, const char *s, size_t len){
+    uint64_t hash = hashBytes(s, len);
+    pthread_mutex_lock(&dict->lock);
+    reserveSlot(&dict->table);
+    struct internSlot *slot = findSlot(&dict->table, s, len, hash);
+    if(! slot->value){
+        /* First time the column has seen this value. */
+        if(dict->valueCount == MAX_COLUMN_CODES){
+            pthread_mutex_unlock(&dict->lock);
+            return COLUMN_NO_CODE;
+        }
+        struct columnValue **block = &dict->blocks[dict->valueCount / VALUE_BLOCK];
+        if(! *block){
+            *block = (struct columnValue *) malloc(sizeof(struct columnValue)
+                * VALUE_BLOCK);
+            assert(*block);
+        }
+        slot->hash = hash;
+        slot->value = internString(s, len);
+        slot->length = len;
+        slot->code = (columnCode) dict->valueCount;
+        (*block)[dict->valueCount % VALUE_BLOCK].value = slot->value;
+        (*block)[dict->valueCount % VALUE_BLOCK].length = len;
+        dict->valueCount++;
+        dict->table.count++;
+    }
+    columnCode code = slot->code;
+    pthread_mutex_unlock(&dict->lock);
+    return code;
+}
+
+const char *columnDecode(struct columnDict *dict, columnCode code, size_t *len){
+    /* Whoever has the code was handed it after its value was stored. */
+    assert(code < MAX_COLUMN_CODES && dict->blocks[code / VALUE_BLOCK]);
+    const struct columnValue *v = 
+        &dict->blocks[code / VALUE_BLOCK][code % VALUE_BLOCK];
+    *len = v->length;
+    return v->value;
+}
+
+int columnValueCount(struct columnDict *dict){
+    pthread_mutex_lock(&dict->lock);
+    int count = dict->valueCount;
+    pthread_mutex_unlock(&dict->lock);
+    return count;
+}
+
+void freeColumnDict(struct columnDict *dict){
+    if(! dict){
+        return;
+    }
+    pthread_mutex_destroy(&dict->lock);
+    free(dict->table.slots);
+    for(size_t i = 0; i < sizeof(dict->blocks) / sizeof(dict->blocks[0]); i++){
+        free(dict->blocks[i]);
+    }
+    free(dict);
+}
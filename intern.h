@@ -0,0 +1,55 @@
+/*
+    Data structure declarations and prototypes for a string interning
+    module. Equal strings added to the pool share a single stored copy, and
+    column dictionaries give each distinct value of a column a small integer
+    code, so low-cardinality columns can be stored as codes and compared
+    with integer compares.
+
+    All functions are safe to call from multiple threads at once. Decoding
+    doesn't take a lock.
+*/
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Code of a value within a column dictionary. */
+typedef uint16_t columnCode;
+
+/* Most distinct values a column dictionary can hold. */
+#define MAX_COLUMN_CODES UINT16_MAX
+
+/* Code returned for a new value once a column dictionary is full. */
+#define COLUMN_NO_CODE UINT16_MAX
+
+/* Returns the pool's NUL terminated copy of the len bytes at s, adding it to
+    the pool if it isn't there yet. The copy lives until freeInterned. */
+const char *internString(const char *s, size_t len);
+
+/* Free every interned string. */
+void freeInterned();
+
+/* Dictionary encoding of a single column. */
+struct columnDict;
+
+/* Returns an empty column dictionary. */
+struct columnDict *newColumnDict();
+
+/* Returns the code of the len bytes at s in the column, giving the value the
+    next code if it hasn't been seen before, or COLUMN_NO_CODE if it hasn't 
+    and the column already holds MAX_COLUMN_CODES values. */
+columnCode columnEncode(struct columnDict *dict, const char *s, size_t len);
+
+/* Returns the interned value of a code from the column, and its length in
+    len. Values never move once coded, so this is safe to call while other
+    values are being added. */
+const char *columnDecode(struct columnDict *dict, columnCode code, size_t *len);
+
+/* Returns the number of distinct values in the column. */
+int columnValueCount(struct columnDict *dict);
+
+/* Free a column dictionary. Its values remain in the pool. */
+void freeColumnDict(struct columnDict *dict);
+
+#endif
@@ -5,291 +5,998 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
 #include "patricia.h"
-#include "a2data.h"
 #include "editdist.h"
 #include "bit.h"
 
+#if defined(__SSE2__)
+#define PT_SSE2 1
+#include <emmintrin.h>
+#endif
+
+/* Set the label of a node to len characters of key_rec's key from start,
+   which label points at, copying them into the node if they fit */
+static void set_label(pt_node_t *n, recordId key_rec, size_t start, size_t len,
+                      const char *label){
+    assert(start + len <= PT_MAX_KEY);
+    n->label_len = (uint16_t)len;
+    if(len <= PT_INLINE_LABEL){
+        if(len) memcpy(n->label_chars, label, len);
+    } else {
+        n->key_rec = key_rec;
+        n->label_start = (uint16_t)start;
+    }
+}
+
 /* 
- * Create a substring from a bit range of the original string
- * Allocates new memory to hold the numBits specified and fills the allocated
- * memory with the numBits specified starting from the startBit of the oldKey
- * array of bytes.
- * 
- * Parameters:
- *   oldKey - source string to extract from
- *   startBit - starting bit position (0-based)
- *   numBits - number of bits to extract
- * Returns: newly allocated string containing the extracted bits
+ * Create a new Patricia trie node, reusing a freed node if there is one
+ * Its label is the len characters of key_rec's key from start, label points
+ * at them (or is NULL if there are none)
  */
-static char *createStem(const char *oldKey, unsigned int startBit, unsigned int numBits){
-    assert(numBits > 0 && startBit >= 0 && oldKey);
-    
-    // Calculate required bytes for the result
-    int extraBytes = 0;
-    if((numBits % BITS_PER_BYTE) > 0){
-        extraBytes = 1;
-    }
-    int totalBytes = (numBits / BITS_PER_BYTE) + extraBytes;
-    
-    // Allocate memory for the new stem
-    char *newStem = malloc(sizeof(char) * (totalBytes + 1)); // +1 for null terminator
-    assert(newStem);
-    
-    // Initialize the new stem
-    memset(newStem, 0, totalBytes + 1);
-    
-    // Copy bits from oldKey to newStem
-    for(unsigned int i = 0; i < numBits; i++){
-        int bit = getBit((char*)oldKey, startBit + i);
-        if(bit){
-            // Set the corresponding bit in newStem
-            unsigned int targetByte = i / BITS_PER_BYTE;
-            unsigned int targetBit = BITS_PER_BYTE - (i % BITS_PER_BYTE) - 1;
-            newStem[targetByte] |= (1 << targetBit);
+static pt_handle_t node_new(ptree_t *t, recordId key_rec, size_t start, size_t len,
+                            const char *label){
+    assert(start + len <= PT_MAX_KEY);
+    pt_handle_t h = t->free_node;
+    if(h != PT_NO_NODE){
+        t->free_node = pt_node(t, h)->first_child;
+    } else {
+        // Map another slab once the last one is full
+        if((t->node_count & (PT_SLAB_NODES - 1)) == 0){
+            assert(t->node_count < PT_NO_NODE - PT_SLAB_NODES);
+            t->slabs = realloc(t->slabs, sizeof(pt_node_t*) * (t->slab_count + 1));
+            assert(t->slabs);
+            t->slabs[t->slab_count++] = arenaAlloc(t->arena, sizeof(pt_node_t) * PT_SLAB_NODES);
         }
+        h = t->node_count++;
     }
-    
-    return newStem;
+    pt_node_t *n = pt_node(t, h);
+    memset(n, 0, sizeof(*n));
+    set_label(n, key_rec, start, len, label);
+    return h;
 }
 
+/* Add a record to the end of a record vector, spilling it once it outgrows
+   the inline ids */
+void pt_records_push(struct arena *arena, record_vec_t *v, recordId rec){
+    if(!v->space){
+        if(v->count < PT_INLINE_RECORDS){
+            v->inline_ids[v->count++] = rec;
+            return;
+        }
+        recordId *ids = arenaAlloc(arena, sizeof(recordId) * 2 * PT_INLINE_RECORDS);
+        memcpy(ids, v->inline_ids, sizeof(recordId) * v->count);
+        v->ids = ids;
+        v->space = 2 * PT_INLINE_RECORDS;
+    } else if(v->count == v->space){
+        v->ids = arenaRealloc(arena, v->ids, sizeof(recordId) * v->space,
+                              sizeof(recordId) * 2 * v->space);
+        v->space *= 2;
+    }
+    v->ids[v->count++] = rec;
+}
 
+/* Remove a record from a record vector, keeping the rest in order */
+bool pt_records_remove(record_vec_t *v, recordId rec){
+    recordId *ids = (recordId *)pt_record_ids(v);
+    uint32_t i = 0;
+    while(i < v->count && ids[i] != rec) i++;
+    if(i == v->count) return false;
+    memmove(&ids[i], &ids[i + 1], sizeof(recordId) * (v->count - i - 1));
+    v->count--;
+    return true;
+}
 
-/* Create a new Patricia trie node */
-static pt_node_t* node_new(const char *label){
-    pt_node_t *n = calloc(1, sizeof(*n));
-    assert(n);
-    n->label = strdup(label ? label : "");
-    assert(n->label);
-    return n;
+/* Ids of the records in a record vector */
+const recordId *pt_record_ids(const record_vec_t *records){
+    return records->space ? records->ids : records->inline_ids;
 }
 
-/* Add a record to the end of the record list */
-static void records_push(record_list_t **head, struct data *rec){
-    record_list_t *r = malloc(sizeof(*r));
-    assert(r);
-    r->rec = rec;
-    r->next = NULL;
-    
-    // If list is empty, make this the first node
-    if(!*head){ 
-        *head = r; 
-        return; 
-    }
-    
-    // Find the last node and append
-    record_list_t *p = *head; 
-    while(p->next) p = p->next; 
-    p->next = r;
+/* Free what a node holds outside its slab, its spilled record ids */
+static void node_clear(ptree_t *t, pt_node_t *n){
+    // The records themselves belong to their store
+    if(n->records.space) arenaFree(t->arena, n->records.ids);
+    n->records.space = 0;
 }
 
-/* Recursively free a Patricia trie node and all its children */
-static void node_free(pt_node_t *n){
-    if(!n) return;
-    
-    // Recursively free all child nodes
-    for(int i = 0; i < n->child_count; i++) 
-        node_free(n->children[i]);
-    free(n->children);
-    
-    // Free the record list and the records themselves
-    record_list_t *p = n->records; 
-    while(p){ 
-        record_list_t *next = p->next; 
-        a2_free((a2_data*)p->rec);  // Free the a2_data structure
-        free(p); 
-        p = next; 
-    }
-    
-    // Free node's label and the node itself
-    free(n->label);
-    free(n);
+/* Put a node without children back on the free list */
+static void node_release(ptree_t *t, pt_handle_t h){
+    pt_node_t *n = pt_node(t, h);
+    node_clear(t, n);
+    n->first_child = t->free_node;
+    t->free_node = h;
 }
 
 /* Create a new empty Patricia trie */
-ptree_t *pt_create(void){
-    ptree_t *t = malloc(sizeof(*t));
+ptree_t *pt_create(pt_key_fn key, void *key_ud){
+    ptree_t *t = calloc(1, sizeof(*t));
     assert(t);
-    t->root = node_new("");  // Root node with empty label
+    t->arena = newArena();
+    t->free_node = PT_NO_NODE;
+    t->key = key;
+    t->key_ud = key_ud;
+    t->root = pt_node(t, node_new(t, STORE_NO_RECORD, 0, 0, NULL));  // Root node with empty label
     return t;
 }
 
-/* Free the entire Patricia trie */
+/* Free the entire Patricia trie, a slab at a time */
 void pt_free(ptree_t *t){ 
     if(!t) return; 
-    node_free(t->root); 
+    // Unless the arena was built to use malloc, it takes every node with it
+    if(!ARENA_BULK_FREE){
+        for(uint32_t h = 0; h < t->node_count; h++)
+            node_clear(t, pt_node(t, h));
+        for(uint32_t i = 0; i < t->slab_count; i++)
+            arenaFree(t->arena, t->slabs[i]);
+    }
+    freeArena(t->arena);
+    free(t->slabs);
+    free(t->child_ids);
+    free(t->child_keys);
+    free(t->empty_keys);
     free(t); 
 }
 
+/* Reserve count entries at the end of the shared child array */
+static uint32_t reserve_children(ptree_t *t, uint32_t count){
+    if(t->child_used + count > t->child_space){
+        uint32_t space = t->child_space ? t->child_space : PT_SLAB_NODES;
+        while(t->child_used + count > space) space *= 2;
+        t->child_ids = realloc(t->child_ids, sizeof(pt_handle_t) * space);
+        assert(t->child_ids);
+        // Padded so a Node16's keys can always be loaded whole
+        t->child_keys = realloc(t->child_keys, space + PT_NODE16);
+        assert(t->child_keys);
+        memset(t->child_keys + t->child_space, 0, space + PT_NODE16 - t->child_space);
+        t->child_space = space;
+    }
+    uint32_t first = t->child_used;
+    t->child_used += count;
+    return first;
+}
+
+/* 
+ * Most children a node with count children has room for
+ * Node4s and Node16s grow a power of two at a time, as most nodes have only
+ * a few children; which of the two a node is only depends on its count
+ */
+static uint32_t node_capacity(uint32_t count){
+    if(count <= PT_NODE16){
+        uint32_t capacity = 0;
+        while(capacity < count) capacity = capacity ? 2 * capacity : 1;
+        return capacity;
+    }
+    if(count <= PT_NODE48) return PT_NODE48;
+    return PT_NODE256;
+}
+
+/* 
+ * Entries of the child array a node with count children takes
+ * Node48s and Node256s follow their children with a lookup by first byte,
+ * of slot + 1 (0 for none) in a byte for a Node48 and uint16_t for a Node256
+ */
+static uint32_t range_size(uint32_t count){
+    uint32_t capacity = node_capacity(count);
+    if(capacity == PT_NODE48) return capacity + 256 / sizeof(pt_handle_t);
+    if(capacity == PT_NODE256) return capacity + 256 * sizeof(uint16_t) / sizeof(pt_handle_t);
+    return capacity;
+}
+
+/* Set the lookup of a Node48 or Node256 from its children's first bytes */
+static void build_lookup(ptree_t *t, pt_node_t *n){
+    uint32_t capacity = node_capacity(n->child_count);
+    const uint8_t *keys = t->child_keys + n->first_child;
+    void *lookup = &t->child_ids[n->first_child + capacity];
+    if(capacity == PT_NODE48){
+        uint8_t *index = lookup;
+        memset(index, 0, 256);
+        for(int i = 0; i < n->child_count; i++) index[keys[i]] = (uint8_t)(i + 1);
+    } else if(capacity == PT_NODE256){
+        uint16_t *direct = lookup;
+        memset(direct, 0, 256 * sizeof(uint16_t));
+        for(int i = 0; i < n->child_count; i++) direct[keys[i]] = (uint16_t)(i + 1);
+    }
+}
+
+/* 
+ * Move a node's children to a range sized for count of them, extending its
+ * range in place if it's at the end of the array. The old range is abandoned
+ */
+static void resize_children(ptree_t *t, pt_node_t *n, uint32_t count){
+    uint32_t old_size = range_size(n->child_count);
+    uint32_t size = range_size(count);
+    if(n->child_count > 0 && size > old_size && n->first_child + old_size == t->child_used){
+        reserve_children(t, size - old_size);
+        return;
+    }
+    uint32_t first = reserve_children(t, size);
+    memcpy(&t->child_ids[first], &t->child_ids[n->first_child],
+           sizeof(pt_handle_t) * n->child_count);
+    memcpy(&t->child_keys[first], &t->child_keys[n->first_child], n->child_count);
+    n->first_child = first;
+}
+
+/* First byte of a node's label, which it is found by, 0 if it has none */
+static uint8_t label_first(const ptree_t *t, const pt_node_t *n){
+    return n->label_len ? (uint8_t)pt_label(t, n)[0] : 0;
+}
+
 /* Add a child node to a parent node */
-static void add_child(pt_node_t *parent, pt_node_t *child){
-    // Expand the children array
-    pt_node_t **new_children = realloc(parent->children, sizeof(pt_node_t*) * (parent->child_count + 1));
-    assert(new_children);
-    parent->children = new_children;
+static void add_child(ptree_t *t, pt_node_t *parent, pt_handle_t child){
+    uint32_t count = parent->child_count;
+    // Children differ in their first bytes, the empty key's leaves are kept apart
+    assert(count < PT_NODE256);
+    // Grow into the next size (or kind) of node once full
+    if(count == node_capacity(count)) resize_children(t, parent, count + 1);
+    
     // Add the new child and increment count
-    parent->children[parent->child_count++] = child;
+    t->child_ids[parent->first_child + count] = child;
+    t->child_keys[parent->first_child + count] = label_first(t, pt_node(t, child));
+    parent->child_count++;
+    if(parent->child_count > PT_NODE16) build_lookup(t, parent);
+}
+
+/* Remove the child at idx from a parent node, keeping the rest in order */
+static void remove_child(ptree_t *t, pt_node_t *parent, int idx){
+    uint32_t first = parent->first_child;
+    uint32_t count = --parent->child_count;
+    memmove(&t->child_ids[first + idx], &t->child_ids[first + idx + 1],
+            sizeof(pt_handle_t) * (count - idx));
+    memmove(&t->child_keys[first + idx], &t->child_keys[first + idx + 1], count - idx);
+    
+    // Shrink into the smaller kind of node once it would fit, so the node
+    // doesn't keep a lookup it has no use for
+    uint32_t old_capacity = node_capacity(count + 1);
+    if(old_capacity > PT_NODE16 && node_capacity(count) < old_capacity){
+        uint32_t new_first = reserve_children(t, range_size(count));
+        memcpy(&t->child_ids[new_first], &t->child_ids[first], sizeof(pt_handle_t) * count);
+        memcpy(&t->child_keys[new_first], &t->child_keys[first], count);
+        parent->first_child = new_first;
+    }
+    if(count > PT_NODE16) build_lookup(t, parent);
 }
 
 /* Find a child node whose label starts with the same character as key */
-static int find_candidate_child(pt_node_t *parent, const char *key){
-    for(int i = 0; i < parent->child_count; i++){
-        if(parent->children[i]->label[0] == key[0]) 
-            return i;
+static int find_candidate_child(ptree_t *t, pt_node_t *parent, const char *key){
+    uint32_t count = parent->child_count;
+    const uint8_t *keys = t->child_keys + parent->first_child;
+    uint8_t c = (uint8_t)key[0];
+    
+    if(count > PT_NODE16){
+        // Node48 or Node256, looked up by the byte
+        const void *lookup = &t->child_ids[parent->first_child + node_capacity(count)];
+        if(count <= PT_NODE48) return ((const uint8_t *)lookup)[c] - 1;
+        return ((const uint16_t *)lookup)[c] - 1;
+    }
+#ifdef PT_SSE2
+    if(count > PT_NODE4){
+        // Node16, every first byte compared at once
+        __m128i match = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)keys),
+                                       _mm_set1_epi8((char)c));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(match) & ((1u << count) - 1);
+        return mask ? __builtin_ctz(mask) : -1;
+    }
+#endif
+    // Node4 (or Node16 without SSE2), the first bytes are scanned
+    for(uint32_t i = 0; i < count; i++){
+        if(keys[i] == c) 
+            return (int)i;
     }
     return -1;  // No matching child found
 }
 
-/* Calculate longest common prefix with bit-level metrics tracking */
-static int lcp_bits(const char *a, const char *b){
-    int bit_pos = 0;
-    int char_pos = 0;
-    
-    // Compare bit by bit
-    while(a[char_pos] && b[char_pos]){
-        // Compare all 8 bits of current character
-        for(int bit = 0; bit < BITS_PER_BYTE; bit++){
-            int bit_a = getBit((char*)a, bit_pos + bit);
-            int bit_b = getBit((char*)b, bit_pos + bit);
-            
-            if(bit_a != bit_b){
-                g_metrics.bitCount += 1ULL;  // Count first mismatch bit
-                return char_pos;  // Return character position where mismatch occurs
-            }
-            g_metrics.bitCount += 1ULL;  // Count each matching bit
-        }
-        bit_pos += BITS_PER_BYTE;
-        char_pos++;
+/* Returns the index of the first differing byte of two words which differ */
+static inline size_t first_diff_byte(uint64_t diff){
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return (size_t)__builtin_clzll(diff) / BITS_PER_BYTE;
+#else
+    return (size_t)__builtin_ctzll(diff) / BITS_PER_BYTE;
+#endif
+}
+
+/* Number of leading bytes two strings of at least n bytes share, up to n */
+size_t pt_common_prefix(const char *a, const char *b, size_t n){
+    size_t i = 0;
+#ifdef PT_SSE2
+    // 16 bytes at a time
+    for(; i + 16 <= n; i += 16){
+        __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i)),
+                                    _mm_loadu_si128((const __m128i *)(b + i)));
+        unsigned int diff = ~(unsigned int)_mm_movemask_epi8(eq) & 0xFFFFu;
+        if(diff) return i + __builtin_ctz(diff);
     }
+#endif
+    // Then a word at a time
+    for(; i + sizeof(uint64_t) <= n; i += sizeof(uint64_t)){
+        uint64_t wa, wb;
+        memcpy(&wa, a + i, sizeof(wa));
+        memcpy(&wb, b + i, sizeof(wb));
+        if(wa != wb) return i + first_diff_byte(wa ^ wb);
+    }
+    while(i < n && a[i] == b[i]) i++;
+    return i;
+}
+
+/* Calculate longest common prefix with bit-level metrics tracking */
+int pt_lcp_bits(const char *a, size_t a_len, const char *b, size_t b_len){
+    size_t n = a_len < b_len ? a_len : b_len;
+    size_t lcp = pt_common_prefix(a, b, n);
     
-    // Handle case where one string is shorter
-    if(a[char_pos] || b[char_pos]){
-        g_metrics.bitCount += 1ULL;  // Count first mismatch bit
+    // Every matching character is 8 bits compared
+    g_metrics.bitCount += (unsigned long long)lcp * BITS_PER_BYTE;
+    if(lcp < n){
+        // As are the bits of the mismatching character up to the first
+        // differing one, which counts as well
+        unsigned int diff = (unsigned char)(a[lcp] ^ b[lcp]);
+        g_metrics.bitCount += (unsigned long long)(__builtin_clz(diff) 
+            - (sizeof(unsigned int) - 1) * BITS_PER_BYTE) + 1ULL;
+    } else if(a_len != b_len){
+        g_metrics.bitCount += 1ULL;  // One string is shorter, count first mismatch bit
     }
     
-    return char_pos;  // Return length of common prefix in characters
+    return (int)lcp;  // Return length of common prefix in characters
 }
 
+/* Add a terminal leaf for rec under parent, labelled with len characters of
+   its key from start */
+static void add_leaf(ptree_t *t, pt_node_t *parent, recordId rec, const char *key,
+                     size_t start, size_t len){
+    pt_handle_t leaf = node_new(t, rec, start, len, key + start);
+    pt_node(t, leaf)->is_terminal = true;
+    pt_records_push(t->arena, &pt_node(t, leaf)->records, rec);
+    add_child(t, parent, leaf);
+}
+
+/* Add a leaf of the empty key for rec to the end of the root's list of them */
+static void add_empty_leaf(ptree_t *t, recordId rec){
+    pt_handle_t leaf = node_new(t, rec, 0, 0, NULL);
+    pt_node(t, leaf)->is_terminal = true;
+    pt_records_push(t->arena, &pt_node(t, leaf)->records, rec);
+    if(t->empty_count == t->empty_space){
+        t->empty_space = t->empty_space ? 2 * t->empty_space : PT_NODE4;
+        t->empty_keys = realloc(t->empty_keys, sizeof(pt_handle_t) * t->empty_space);
+        assert(t->empty_keys);
+    }
+    t->empty_keys[t->empty_count++] = leaf;
+}
 
 /* Insert a key-record pair into the Patricia trie */
-void pt_insert(ptree_t *t, const char *key, struct data *rec){
+void pt_insert(ptree_t *t, const char *key, size_t keyLen, recordId rec){
+    assert(keyLen <= PT_MAX_KEY);
+    if(keyLen == 0){
+        add_empty_leaf(t, rec);
+        return;
+    }
     pt_node_t *cur = t->root; 
     const char *rest = key;  // Remaining part of key to insert
+    size_t restLen = keyLen;
     
     while(1){
-        int idx = find_candidate_child(cur, rest);
+        int idx = find_candidate_child(t, cur, rest);
         
         // Case 1: No matching child - create new leaf node
         if(idx < 0){ 
-            pt_node_t *leaf = node_new(rest); 
-            leaf->is_terminal = true; 
-            records_push(&leaf->records, rec); 
-            add_child(cur, leaf); 
+            add_leaf(t, cur, rec, key, rest - key, restLen); 
             return; 
         }
         
-        pt_node_t *child = cur->children[idx];
-        
-        // Calculate longest common prefix using bit-level comparison
-        int lcp = 0;
-        const char *lab = child->label; 
-        int bit_pos = 0;
+        pt_handle_t child_h = t->child_ids[cur->first_child + idx];
+        pt_node_t *child = pt_node(t, child_h);
         
-        // Compare bit by bit to find common prefix
-        while(rest[lcp] && lab[lcp]){
-            bool match = true;
-            for(int bit = 0; bit < BITS_PER_BYTE; bit++){
-                int bit_rest = getBit((char*)rest, bit_pos + bit);
-                int bit_lab = getBit((char*)lab, bit_pos + bit);
-                if(bit_rest != bit_lab){
-                    match = false;
-                    break;
-                }
-            }
-            if(!match) break;
-            bit_pos += BITS_PER_BYTE;
-            lcp++;
-        }
+        // Calculate longest common prefix
+        const char *lab = pt_label(t, child); 
+        int lab_len = child->label_len;
+        int lcp = (int)pt_common_prefix(rest, lab, restLen < (size_t)lab_len ? restLen : (size_t)lab_len);
         
         // Case 2: No common prefix - create new sibling
         if(lcp == 0){ 
-            pt_node_t *leaf = node_new(rest); 
-            leaf->is_terminal = true; 
-            records_push(&leaf->records, rec); 
-            add_child(cur, leaf); 
+            add_leaf(t, cur, rec, key, rest - key, restLen); 
             return; 
         }
         
         // Case 3: Partial match - need to split the edge
-        if(lcp < (int)strlen(lab)){
-            // Create intermediate node with common prefix using createStem for bit-level precision
-            char *prefix = createStem(lab, 0, lcp * BITS_PER_BYTE); 
-            char *suffix = createStem(lab, lcp * BITS_PER_BYTE, (strlen(lab) - lcp) * BITS_PER_BYTE);
-            
-            pt_node_t *mid = node_new(prefix); 
-            free(prefix);
+        if(lcp < lab_len){
+            // The intermediate node takes the common prefix of the child's label,
+            // which keeps the rest
+            pt_handle_t mid_h = node_new(t, child->key_rec, child->label_start, lcp, lab); 
+            pt_node_t *mid = pt_node(t, mid_h);
             
             // Replace child with intermediate node
-            cur->children[idx] = mid;
-            free(child->label); 
-            child->label = suffix; 
-            add_child(mid, child);
+            t->child_ids[cur->first_child + idx] = mid_h;
+            if(lab_len <= PT_INLINE_LABEL){
+                memmove(child->label_chars, child->label_chars + lcp, lab_len - lcp);
+                child->label_len -= lcp;
+            } else {
+                set_label(child, child->key_rec, child->label_start + lcp, lab_len - lcp,
+                          lab + lcp);
+            }
+            add_child(t, mid, child_h);
             
             // Handle remaining part of the key
-            const char *remain = rest + lcp;
-            if(*remain == '\0'){ 
+            if(lcp == (int)restLen){ 
                 // Key ends here - intermediate node becomes terminal
                 mid->is_terminal = true; 
-                records_push(&mid->records, rec); 
+                pt_records_push(t->arena, &mid->records, rec); 
             } else { 
                 // Create new leaf for remaining part
-                pt_node_t *leaf = node_new(remain); 
-                leaf->is_terminal = true; 
-                records_push(&leaf->records, rec); 
-                add_child(mid, leaf); 
+                add_leaf(t, mid, rec, key, rest + lcp - key, restLen - lcp); 
             }
             return;
         } else {
             // Case 4: Complete match - continue down the tree
             rest += lcp; 
+            restLen -= lcp;
             cur = child; 
-            if(*rest == '\0'){ 
+            if(restLen == 0){ 
                 // Key ends here - mark current node as terminal
                 cur->is_terminal = true; 
-                records_push(&cur->records, rec); 
+                pt_records_push(t->arena, &cur->records, rec); 
                 return; 
             }
         }
     }
 }
 
+/* Compare two keys of the given lengths in the same way as strcmp */
+static int compare_keys(const char *a, size_t a_len, const char *b, size_t b_len){
+    int c = memcmp(a, b, a_len < b_len ? a_len : b_len);
+    if(c != 0) return c;
+    return (a_len > b_len) - (a_len < b_len);
+}
+
+/* Keys sorted by insertion once there are no more than this many of them */
+#define BULK_SORT_SMALL 32
+
+/* 
+ * Sort order[0..n) by key, the keys all sharing their first depth characters
+ * Sorts by one byte at a time, most significant first, keys which end coming
+ * before any which go on; equal keys stay in the order they were given
+ */
+static void bulk_sort(const char *const *keys, const size_t *key_lens, uint32_t *order,
+                      uint32_t *scratch, size_t n, size_t depth){
+    while(n > BULK_SORT_SMALL){
+        // Bucket 0 holds the keys ending here, bucket c + 1 those going on with c
+        size_t counts[257] = {0};
+        for(size_t i = 0; i < n; i++){
+            uint32_t k = order[i];
+            counts[key_lens[k] > depth ? (uint8_t)keys[k][depth] + 1 : 0]++;
+        }
+        size_t starts[257];
+        size_t pos = 0;
+        int used = 0;
+        for(int b = 0; b < 257; b++){
+            starts[b] = pos;
+            pos += counts[b];
+            if(counts[b]) used = b;
+        }
+        if(counts[used] == n){
+            // Every key goes on with the same byte (or they're all equal)
+            if(used == 0) return;
+            depth++;
+            continue;
+        }
+        for(size_t i = 0; i < n; i++){
+            uint32_t k = order[i];
+            scratch[starts[key_lens[k] > depth ? (uint8_t)keys[k][depth] + 1 : 0]++] = k;
+        }
+        memcpy(order, scratch, sizeof(uint32_t) * n);
+        
+        // starts now holds the end of each bucket
+        for(int b = 1; b < 257; b++){
+            size_t count = counts[b];
+            if(count > 1)
+                bulk_sort(keys, key_lens, order + starts[b] - count, scratch, count, depth + 1);
+        }
+        return;
+    }
+    for(size_t i = 1; i < n; i++){
+        uint32_t k = order[i];
+        size_t j = i;
+        while(j > 0 && compare_keys(keys[order[j - 1]] + depth, key_lens[order[j - 1]] - depth,
+                                     keys[k] + depth, key_lens[k] - depth) > 0){
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = k;
+    }
+}
+
+/* A finished node waiting for its parent, and the first key under it */
+typedef struct {
+    pt_handle_t node;
+    uint32_t first_key;
+} bulk_child_t;
+
+/* A node whose children are still being found, end characters into its keys */
+typedef struct {
+    size_t end;
+    size_t children;            // Where its children start in the pending list
+    size_t keys;                // Its own keys in the sorted order, if it has any
+    size_t keys_end;
+} bulk_open_t;
+
+/* State of a bulk load */
+typedef struct {
+    ptree_t *t;
+    const char *const *keys;
+    const recordId *records;
+    const uint32_t *order;
+    bulk_child_t *pending;
+    size_t pending_count;
+    size_t pending_space;
+} bulk_t;
+
+/* Add a finished node to the children of the open node it belongs to */
+static void bulk_push_child(bulk_t *b, pt_handle_t node, uint32_t first_key){
+    if(b->pending_count == b->pending_space){
+        b->pending_space = b->pending_space ? 2 * b->pending_space : PT_NODE256;
+        b->pending = realloc(b->pending, sizeof(bulk_child_t) * b->pending_space);
+        assert(b->pending);
+    }
+    b->pending[b->pending_count].node = node;
+    b->pending[b->pending_count].first_key = first_key;
+    b->pending_count++;
+}
+
+/* 
+ * Create the node for an open one, whose label starts start characters in,
+ * and hand it to its parent. Its fields are set as though its keys had been
+ * inserted one at a time: its children are in the order their first keys were
+ * given, and a long label is held in the key given first
+ */
+static void bulk_finish(bulk_t *b, const bulk_open_t *o, size_t start, bool root){
+    ptree_t *t = b->t;
+    bulk_child_t *children = b->pending + o->children;
+    uint32_t count = b->pending_count - o->children;
+    
+    // Children were found in key order, and there are few enough to sort simply
+    for(uint32_t i = 1; i < count; i++){
+        bulk_child_t c = children[i];
+        uint32_t j = i;
+        while(j > 0 && children[j - 1].first_key > c.first_key){
+            children[j] = children[j - 1];
+            j--;
+        }
+        children[j] = c;
+    }
+    uint32_t first_key = count ? children[0].first_key : UINT32_MAX;
+    if(o->keys < o->keys_end && b->order[o->keys] < first_key) first_key = b->order[o->keys];
+    
+    pt_handle_t h = 0;
+    if(!root){
+        h = node_new(t, b->records[first_key], start, o->end - start,
+                     b->keys[first_key] + start);
+    }
+    pt_node_t *n = pt_node(t, h);
+    if(count){
+        n->first_child = reserve_children(t, range_size(count));
+        for(uint32_t i = 0; i < count; i++){
+            t->child_ids[n->first_child + i] = children[i].node;
+            t->child_keys[n->first_child + i] = label_first(t, pt_node(t, children[i].node));
+        }
+        n->child_count = count;
+        if(count > PT_NODE16) build_lookup(t, n);
+    }
+    for(size_t i = o->keys; i < o->keys_end; i++){
+        n->is_terminal = true;
+        pt_records_push(t->arena, &n->records, b->records[b->order[i]]);
+    }
+    
+    b->pending_count = o->children;
+    if(!root) bulk_push_child(b, h, first_key);
+}
+
+/* Build the trie from sorted keys, from the longest common prefix of each
+   pair of neighbours, keeping a stack of the nodes on the current key's path */
+void pt_bulk_load(ptree_t *t, const char *const *keys, const size_t *key_lens,
+                  const recordId *records, size_t n){
+    assert(t->root->child_count == 0 && !t->root->is_terminal && t->empty_count == 0);
+    assert(n < UINT32_MAX);
+    if(n == 0) return;
+    
+    uint32_t *order = malloc(sizeof(uint32_t) * n);
+    uint32_t *scratch = malloc(sizeof(uint32_t) * n);
+    assert(order && scratch);
+    for(size_t i = 0; i < n; i++){
+        assert(key_lens[i] <= PT_MAX_KEY);
+        order[i] = (uint32_t)i;
+    }
+    bulk_sort(keys, key_lens, order, scratch, n, 0);
+    free(scratch);
+    
+    bulk_t b = {0};
+    b.t = t;
+    b.keys = keys;
+    b.records = records;
+    b.order = order;
+    size_t space = 64;
+    size_t open = 1;
+    bulk_open_t *stack = malloc(sizeof(bulk_open_t) * space);
+    assert(stack);
+    stack[0] = (bulk_open_t){0, 0, 0, 0};  // The root
+    
+    for(size_t i = 0; i < n; ){
+        // Each key is only added once, with all of its records
+        uint32_t k = order[i];
+        size_t len = key_lens[k];
+        size_t end = i + 1;
+        while(end < n && compare_keys(keys[order[end]], key_lens[order[end]], keys[k], len) == 0)
+            end++;
+        size_t lcp = 0;
+        if(i > 0){
+            uint32_t prev = order[i - 1];
+            lcp = pt_common_prefix(keys[prev], keys[k], key_lens[prev] < len ? key_lens[prev] : len);
+        }
+        
+        // Finish the nodes deeper than the prefix this key shares with the last,
+        // splitting the label of the last one finished if it runs past it
+        while(stack[open - 1].end > lcp){
+            bulk_open_t done = stack[--open];
+            size_t start = stack[open - 1].end;
+            if(start < lcp){
+                stack[open++] = (bulk_open_t){lcp, done.children, 0, 0};
+                start = lcp;
+            }
+            bulk_finish(&b, &done, start, false);
+        }
+        
+        if(len == 0){
+            // Empty keys are each a leaf of their own, as inserting them makes them
+            for(size_t j = i; j < end; j++) add_empty_leaf(t, records[order[j]]);
+        } else {
+            assert(stack[open - 1].end < len);
+            if(open == space){
+                space *= 2;
+                stack = realloc(stack, sizeof(bulk_open_t) * space);
+                assert(stack);
+            }
+            stack[open++] = (bulk_open_t){len, b.pending_count, i, end};
+        }
+        i = end;
+    }
+    while(open > 1){
+        bulk_open_t done = stack[--open];
+        bulk_finish(&b, &done, stack[open - 1].end, false);
+    }
+    bulk_finish(&b, &stack[0], 0, true);
+    
+    free(stack);
+    free(b.pending);
+    free(order);
+}
+
+/* Fewest keys worth loading on a thread of their own */
+#define BULK_GROUP_MIN 4096
+
+/* Keys loaded into a trie of their own, on a thread of its own */
+typedef struct {
+    ptree_t *tree;
+    const char *const *keys;
+    const size_t *key_lens;
+    const recordId *records;
+    size_t n;
+    pthread_t thread;
+} bulk_group_t;
+
+/* Load a group's keys into its trie */
+static void *bulk_group_load(void *arg){
+    bulk_group_t *g = (bulk_group_t *)arg;
+    pt_bulk_load(g->tree, g->keys, g->key_lens, g->records, g->n);
+    return NULL;
+}
+
+/* Put a node which was never given out on the free list */
+static void node_discard(ptree_t *t, pt_handle_t h){
+    pt_node_t *n = pt_node(t, h);
+    memset(n, 0, sizeof(*n));
+    n->first_child = t->free_node;
+    t->free_node = h;
+}
+
+/* 
+ * Move the nodes of a group's trie into t, after its last slab, and free the
+ * group's trie. The children of its root are added to root_children, which
+ * first_key gives the first key under by their first byte. Unless it is the
+ * last to be moved, the unused end of its last slab is put on the free list
+ */
+static void bulk_graft(ptree_t *t, ptree_t *sub, bulk_child_t *root_children,
+                       uint32_t *root_count, const uint32_t *first_key, bool last){
+    // The slabs are handed over whole, so handles only move by whole slabs
+    pt_handle_t base = t->slab_count << PT_SLAB_SHIFT;
+    t->slabs = realloc(t->slabs, sizeof(pt_node_t*) * (t->slab_count + sub->slab_count));
+    assert(t->slabs);
+    memcpy(t->slabs + t->slab_count, sub->slabs, sizeof(pt_node_t*) * sub->slab_count);
+    t->slab_count += sub->slab_count;
+    
+    uint32_t child_base = reserve_children(t, sub->child_used);
+    if(sub->child_used){
+        memcpy(t->child_ids + child_base, sub->child_ids, sizeof(pt_handle_t) * sub->child_used);
+        memcpy(t->child_keys + child_base, sub->child_keys, sub->child_used);
+    }
+    for(pt_handle_t h = 1; h < sub->node_count; h++){
+        pt_node_t *n = pt_node(t, base + h);
+        if(n->child_count == 0) continue;
+        n->first_child += child_base;
+        // Node48 and Node256 lookups hold slots rather than handles
+        for(uint32_t i = 0; i < n->child_count; i++) t->child_ids[n->first_child + i] += base;
+    }
+    
+    pt_node_t *root = sub->root;
+    for(uint32_t i = 0; i < root->child_count; i++){
+        uint8_t first = sub->child_keys[root->first_child + i];
+        root_children[*root_count].node = base + sub->child_ids[root->first_child + i];
+        root_children[*root_count].first_key = first_key[first];
+        (*root_count)++;
+    }
+    node_discard(t, base);
+    t->node_count = base + sub->node_count;
+    if(!last){
+        for(pt_handle_t h = t->node_count; h < (t->slab_count << PT_SLAB_SHIFT); h++)
+            node_discard(t, h);
+        t->node_count = t->slab_count << PT_SLAB_SHIFT;
+    }
+    
+    arenaAdopt(t->arena, sub->arena);
+    free(sub->slabs);
+    free(sub->child_ids);
+    free(sub->child_keys);
+    free(sub);
+}
+
+/* 
+ * Split the keys into groups by their first byte, load each group into a trie
+ * of its own on a thread of its own, then move their nodes into t and join
+ * them under its root. Keys with different first bytes share no edge, so the
+ * tries need no merging
+ */
+void pt_bulk_load_parallel(ptree_t *t, const char *const *keys, const size_t *key_lens,
+                           const recordId *records, size_t n, int threads){
+    assert(t->root->child_count == 0 && !t->root->is_terminal && t->empty_count == 0);
+    assert(n < UINT32_MAX);
+    int groups = threads;
+    if((size_t)groups > n / BULK_GROUP_MIN) groups = (int)(n / BULK_GROUP_MIN);
+    if(groups <= 1){
+        pt_bulk_load(t, keys, key_lens, records, n);
+        return;
+    }
+    
+    // Gather the keys by first byte, each byte's in the order they were given
+    size_t starts[257] = {0};
+    uint32_t first_key[256];
+    for(size_t i = n; i-- > 0; ){
+        uint8_t first = (uint8_t)keys[i][0];
+        starts[first + 1]++;
+        first_key[first] = (uint32_t)i;
+    }
+    for(int c = 0; c < 256; c++) starts[c + 1] += starts[c];
+    const char **group_keys = malloc(sizeof(char*) * n);
+    size_t *group_lens = malloc(sizeof(size_t) * n);
+    recordId *group_records = malloc(sizeof(recordId) * n);
+    assert(group_keys && group_lens && group_records);
+    size_t pos[256];
+    memcpy(pos, starts, sizeof(pos));
+    for(size_t i = 0; i < n; i++){
+        size_t p = pos[(uint8_t)keys[i][0]]++;
+        group_keys[p] = keys[i];
+        group_lens[p] = key_lens[i];
+        group_records[p] = records[i];
+    }
+    
+    // Each group takes a run of first bytes, about an even share of the keys.
+    // The empty keys, all there are of byte 0, belong to no group
+    bulk_group_t *g = calloc(groups, sizeof(bulk_group_t));
+    assert(g);
+    int c = 1;
+    for(int i = 0; i < groups; i++){
+        size_t end = i == groups - 1 ? n : n / groups * (i + 1);
+        size_t from = starts[c];
+        while(c < 256 && starts[c] < end) c++;
+        g[i].tree = pt_create(t->key, t->key_ud);
+        g[i].keys = group_keys + from;
+        g[i].key_lens = group_lens + from;
+        g[i].records = group_records + from;
+        g[i].n = starts[c] - from;
+    }
+    
+    // The calling thread loads the first group itself
+    for(int i = 1; i < groups; i++){
+        int err = pthread_create(&g[i].thread, NULL, bulk_group_load, &g[i]);
+        assert(err == 0);
+    }
+    bulk_group_load(&g[0]);
+    for(int i = 1; i < groups; i++){
+        pthread_join(g[i].thread, NULL);
+    }
+    
+    // Empty keys are each a leaf of the root's own, in the order they were given,
+    // and the rest of their slabs is left to later nodes
+    for(size_t i = 0; i < starts[1]; i++) add_empty_leaf(t, group_records[i]);
+    free(group_keys);
+    free(group_lens);
+    free(group_records);
+    for(pt_handle_t h = t->node_count; h < (t->slab_count << PT_SLAB_SHIFT); h++)
+        node_discard(t, h);
+    t->node_count = t->slab_count << PT_SLAB_SHIFT;
+    bulk_child_t root_children[PT_NODE256];
+    uint32_t count = 0;
+    for(int i = 0; i < groups; i++){
+        bulk_graft(t, g[i].tree, root_children, &count, first_key, i == groups - 1);
+    }
+    free(g);
+    
+    // As the children of any node, in the order of the first key under each
+    for(uint32_t i = 1; i < count; i++){
+        bulk_child_t ch = root_children[i];
+        uint32_t j = i;
+        while(j > 0 && root_children[j - 1].first_key > ch.first_key){
+            root_children[j] = root_children[j - 1];
+            j--;
+        }
+        root_children[j] = ch;
+    }
+    pt_node_t *root = t->root;
+    root->first_child = reserve_children(t, range_size(count));
+    for(uint32_t i = 0; i < count; i++){
+        t->child_ids[root->first_child + i] = root_children[i].node;
+        t->child_keys[root->first_child + i] = label_first(t, pt_node(t, root_children[i].node));
+    }
+    root->child_count = count;
+    if(count > PT_NODE16) build_lookup(t, root);
+}
+
+/* Fold a node's only child into it, joining their labels, the node's label
+   starts start characters into its keys */
+static void merge_child(ptree_t *t, pt_node_t *n, size_t start){
+    pt_handle_t child_h = t->child_ids[n->first_child];
+    pt_node_t *child = pt_node(t, child_h);
+    
+    // The key of any record under the child holds both labels back to back.
+    // The node's own range of the child array is left unused
+    const pt_node_t *term = child;
+    while(!term->is_terminal) term = pt_child(t, term, 0);
+    recordId rec = pt_record_ids(&term->records)[0];
+    node_clear(t, n);
+    size_t len = n->label_len + child->label_len;
+    set_label(n, rec, start, len, t->key(t->key_ud, rec) + start);
+    n->first_child = child->first_child;
+    n->child_count = child->child_count;
+    n->is_terminal = child->is_terminal;
+    n->records = child->records;
+    
+    child->records.space = 0;  // Now the node's
+    child->child_count = 0;
+    node_release(t, child_h);
+}
+
+/* Remove the records pred is true for from a record vector, keeping the rest
+   in order, returns how many were removed */
+static uint32_t records_remove_if(record_vec_t *v, pt_record_pred pred, void *ud){
+    recordId *ids = (recordId *)pt_record_ids(v);
+    uint32_t kept = 0;
+    for(uint32_t i = 0; i < v->count; i++){
+        if(pred && !pred(ids[i], ud)) ids[kept++] = ids[i];
+    }
+    uint32_t removed = v->count - kept;
+    v->count = kept;
+    return removed;
+}
+
+/* Remove the leaves of the empty key whose record pred is true for, keeping
+   the rest in order, returns how many were removed */
+static uint32_t delete_empty(ptree_t *t, pt_record_pred pred, void *ud){
+    uint32_t kept = 0;
+    for(uint32_t i = 0; i < t->empty_count; i++){
+        pt_handle_t leaf = t->empty_keys[i];
+        if(pred && !pred(pt_record_ids(&pt_node(t, leaf)->records)[0], ud)){
+            t->empty_keys[kept++] = leaf;
+        } else {
+            node_release(t, leaf);
+        }
+    }
+    uint32_t removed = t->empty_count - kept;
+    t->empty_count = kept;
+    return removed;
+}
+
+/* Remove the records of the given key which pred is true for */
+uint32_t pt_delete(ptree_t *t, const char *key, pt_record_pred pred, void *ud){
+    // The empty key's leaves aren't under the root's children
+    if(*key == '\0') return delete_empty(t, pred, ud);
+    
+    pt_node_t *parent = NULL;
+    pt_node_t *cur = t->root;
+    int cur_idx = -1;
+    const char *rest = key;
+    size_t parent_start = 0, cur_start = 0;  // Where their labels start in the key
+    
+    // Follow the key down to its node, without touching the metrics
+    while(*rest){
+        int idx = find_candidate_child(t, cur, rest);
+        if(idx < 0) return 0;
+        
+        pt_node_t *child = pt_child(t, cur, idx);
+        if(strncmp(rest, pt_label(t, child), child->label_len) != 0) return 0;
+        parent_start = cur_start;
+        cur_start = rest - key;
+        rest += child->label_len;
+        parent = cur;
+        cur = child;
+        cur_idx = idx;
+    }
+    
+    uint32_t removed = records_remove_if(&cur->records, pred, ud);
+    if(removed == 0 || cur->records.count > 0) return removed;
+    
+    // The key is gone, leave the trie as if it had never been inserted
+    cur->is_terminal = false;
+    if(cur == t->root) return removed;
+    if(cur->child_count == 0){
+        node_release(t, t->child_ids[parent->first_child + cur_idx]);
+        remove_child(t, parent, cur_idx);
+        if(parent != t->root && !parent->is_terminal && parent->child_count == 1)
+            merge_child(t, parent, parent_start);
+    } else if(cur->child_count == 1){
+        merge_child(t, cur, cur_start);
+    }
+    return removed;
+}
+
+/* Returns true for the record ud points at */
+static bool same_record(recordId rec, void *ud){
+    return rec == *(const recordId *)ud;
+}
+
+/* Remove a record from the list of the given key */
+bool pt_remove_record(ptree_t *t, const char *key, recordId rec){
+    return pt_delete(t, key, same_record, &rec) > 0;
+}
+
+/* Move a record from one key to another, as a removal then an insertion */
+bool pt_update(ptree_t *t, const char *key, recordId rec, const char *new_key,
+               size_t new_key_len, recordId new_rec){
+    if(!pt_remove_record(t, key, rec)) return false;
+    pt_insert(t, new_key, new_key_len, new_rec);
+    return true;
+}
+
 /* 
  * Search for a key in the Patricia trie, tracking where mismatch occurs
  * Returns the mismatch node and sets exact_terminal if exact match found
  */
-pt_node_t* pt_search_with_mismatch(ptree_t *t, const char *key, bool *exact_terminal){
+pt_node_t* pt_search_with_mismatch(ptree_t *t, const char *key, bool *exact_terminal,
+                                   size_t *label_start){
     if(exact_terminal) *exact_terminal = false;
     
     pt_node_t *cur = t->root; 
     const char *rest = key; 
+    size_t restLen = strlen(key);
+    *label_start = 0;
     g_metrics.nodeCount = 0ULL;  // Initialize node count
     
     while(1){
         g_metrics.nodeCount++;  // Count each node visit
         
-        int idx = find_candidate_child(cur, rest);
+        // Only the empty key ends at the root, its first leaf is the match
+        if(*rest == '\0' && t->empty_count){
+            if(exact_terminal) *exact_terminal = true;
+            return pt_node(t, t->empty_keys[0]);
+        }
+        
+        int idx = find_candidate_child(t, cur, rest);
         if(idx < 0) return cur;  // No matching child - mismatch at current node
         
-        pt_node_t *child = cur->children[idx];
+        pt_node_t *child = pt_child(t, cur, idx);
+        *label_start = rest - key;
         
         // Calculate common prefix with bit counting
-        int lcp = lcp_bits(rest, child->label);
+        int lcp = pt_lcp_bits(rest, restLen, pt_label(t, child), child->label_len);
         
         // Mismatch within the edge label
-        if(lcp < (int)strlen(child->label)) return child;
+        if(lcp < (int)child->label_len) return child;
         
         // Continue traversal
         rest += lcp; 
+        restLen -= lcp;
         cur = child;
         
         // Check if we've consumed the entire key
@@ -302,57 +1009,116 @@ pt_node_t* pt_search_with_mismatch(ptree_t *t, const char *key, bool *exact_term
     }
 }
 
-/* Recursively traverse the trie from a given node, calling callback for each terminal */
-static void traverse(pt_node_t *node, const char *prefix, pt_visit_cb cb, void *ud){
-    if(!node) return;
+/* Count the nodes under n, which is reachable through the child array */
+static void node_stats(const ptree_t *t, const pt_node_t *n, pt_memory_stats_t *stats){
+    stats->nodes++;
+    if(n->is_terminal) stats->terminals++;
+    if(n->child_count == 0) stats->leaves++;
+    if(n->child_count > stats->max_fanout) stats->max_fanout = n->child_count;
+    
+    size_t len = n->label_len;
+    int bucket = 0;
+    while(bucket < PT_LABEL_BUCKETS - 1 && len >= ((size_t)1 << bucket)) bucket++;
+    stats->label_lengths[bucket]++;
+    stats->label_chars += len;
+    if(len > 0 && len <= PT_INLINE_LABEL) stats->inline_labels++;
+    
+    stats->records += n->records.count;
+    if(n->records.space){
+        stats->spilled_arrays++;
+        stats->spilled_bytes += sizeof(recordId) * n->records.space;
+        stats->spilled_unused += sizeof(recordId) * (n->records.space - n->records.count);
+    } else {
+        stats->inline_records += n->records.count;
+    }
+    
+    if(n->child_count > 0){
+        uint32_t capacity = node_capacity(n->child_count);
+        int kind = n->child_count <= PT_NODE4 ? 0 : n->child_count <= PT_NODE16 ? 1 :
+                   n->child_count <= PT_NODE48 ? 2 : 3;
+        stats->node_kinds[kind]++;
+        stats->lookup_bytes += (sizeof(pt_handle_t) + 1) * (range_size(n->child_count) - capacity);
+    }
+    
+    for(int i = 0; i < n->child_count; i++)
+        node_stats(t, pt_child(t, n, i), stats);
+}
+
+/* Fill in the memory held by the trie */
+void pt_memory_stats(const ptree_t *t, pt_memory_stats_t *stats){
+    memset(stats, 0, sizeof(*stats));
+    node_stats(t, t->root, stats);
+    for(uint32_t i = 0; i < t->empty_count; i++)
+        node_stats(t, pt_node(t, t->empty_keys[i]), stats);
     
+    stats->slab_count = t->slab_count;
+    stats->slab_bytes = sizeof(pt_node_t) * PT_SLAB_NODES * t->slab_count;
+    stats->slab_unused = stats->slab_bytes - sizeof(pt_node_t) * stats->nodes;
+    stats->child_bytes = (sizeof(pt_handle_t) + 1) * t->child_space;
+    if(t->child_keys) stats->child_bytes += PT_NODE16;
+    stats->child_unused = stats->child_bytes - stats->lookup_bytes
+                        - (sizeof(pt_handle_t) + 1) * (stats->nodes - 1 - t->empty_count);
+    arenaUsage(t->arena, &stats->arena);
+}
+
+/* 
+ * Recursively traverse the trie from a given node, calling callback for each terminal
+ * Keys run from start, the depth of the node traversal began at, to the end
+ * of the node's label at end, and are read straight out of the key of each
+ * terminal's first record
+ */
+static void traverse(ptree_t *t, pt_node_t *node, size_t start, size_t end,
+                     pt_visit_cb cb, void *ud){
     // Count node access - each time we look at a new node
     g_metrics.nodeCount++;
     
-    // Build the complete key by concatenating prefix and node label
-    size_t L1 = strlen(prefix), L2 = strlen(node->label); 
-    char *cur = (char*)malloc(L1 + L2 + 1);
-    memcpy(cur, prefix, L1); 
-    memcpy(cur + L1, node->label, L2); 
-    cur[L1 + L2] = '\0';
-    
     // If this is a terminal node, call the callback
-    if(node->is_terminal) cb(cur, node->records, ud);
-    
-    // Recursively traverse all children
-    for(int i = 0; i < node->child_count; i++) 
-        traverse(node->children[i], cur, cb, ud);
+    if(node->is_terminal){
+        const char *key = t->key(t->key_ud, pt_record_ids(&node->records)[0]) + start;
+        cb(key, end - start, &node->records, ud);
+    }
     
-    free(cur);
+    // Recursively traverse all children, the root's leaves of the empty key first
+    if(node == t->root){
+        for(uint32_t i = 0; i < t->empty_count; i++)
+            traverse(t, pt_node(t, t->empty_keys[i]), start, end, cb, ud);
+    }
+    for(int i = 0; i < node->child_count; i++){
+        pt_node_t *child = pt_child(t, node, i);
+        traverse(t, child, start, end + child->label_len, cb, ud);
+    }
 }
 
 /* Public interface for tree traversal */
-void pt_traverse_keys_from(pt_node_t *node, const char *prefix, pt_visit_cb cb, void *ud){ 
-    traverse(node, prefix, cb, ud); 
+void pt_traverse_keys_from(ptree_t *t, pt_node_t *node, size_t label_start,
+                           pt_visit_cb cb, void *ud){ 
+    if(!node) return;
+    traverse(t, node, label_start, label_start + node->label_len, cb, ud); 
 }
 
 /* Data structure for tracking the best match during similarity search */
 typedef struct { 
     const char *query; 
+    int query_len;
     int best_dist; 
-    char *best_key; 
-    record_list_t *best_records; 
+    const char *best_key;       // Points into the key of its record
+    size_t best_len;
+    const record_vec_t *best_records; 
 } sim_ud_t;
 
 /* Callback function to find the best matching key based on edit distance */
-static void acc_best(const char *full_key, record_list_t *records, void *ud_){
+static void acc_best(const char *key, size_t key_len, const record_vec_t *records, void *ud_){
     sim_ud_t *ud = (sim_ud_t*)ud_;
     g_metrics.stringCount++;  // Count each string comparison
     
     // Calculate edit distance between query and current key
-    int d = editDistance((char*)ud->query, (char*)full_key, 
-                        (int)strlen(ud->query), (int)strlen(full_key));
+    int d = editDistance((char*)ud->query, (char*)key, ud->query_len, (int)key_len);
     
     // Update best match if this is better (lower distance, or same distance but lexicographically earlier)
     if(!ud->best_key || d < ud->best_dist || 
-       (d == ud->best_dist && strcmp(full_key, ud->best_key) < 0)){
-        free(ud->best_key); 
-        ud->best_key = strdup(full_key); 
+       (d == ud->best_dist && compare_keys(key, key_len, ud->best_key, ud->best_len) < 0)){
+        ud->best_key = key; 
+        ud->best_len = key_len;
         ud->best_dist = d; 
         ud->best_records = records;
     }
@@ -361,26 +1127,31 @@ static void acc_best(const char *full_key, record_list_t *records, void *ud_){
 /* 
  * Find the most similar key in the subtree rooted at mismatch_node
  * Uses edit distance to determine similarity
- * Returns the record list of the best match, optionally outputs the best key
+ * Returns the records of the best match, optionally outputs the best key
  */
-record_list_t* pt_search_similar_under(pt_node_t *mismatch_node, const char *query, char **best_key_out){
+const record_vec_t* pt_search_similar_under(ptree_t *t, pt_node_t *mismatch_node, size_t label_start,
+                                            const char *query, char **best_key_out){
     if(!mismatch_node) return NULL;
     
     // Initialize search state
     sim_ud_t ud = {0}; 
     ud.query = query; 
+    ud.query_len = (int)strlen(query);
     ud.best_dist = 0x3f3f3f3f;  // Large initial distance
     ud.best_key = NULL; 
     ud.best_records = NULL;
     
     // Traverse all keys in the subtree to find the best match
-    pt_traverse_keys_from(mismatch_node, "", acc_best, &ud);
+    pt_traverse_keys_from(t, mismatch_node, label_start, acc_best, &ud);
     
-    // Return the best key if requested, otherwise free it
-    if(best_key_out) 
-        *best_key_out = ud.best_key; 
-    else 
-        free(ud.best_key);
+    // Copy out the best key if requested
+    if(best_key_out){
+        *best_key_out = NULL;
+        if(ud.best_key){
+            *best_key_out = strndup(ud.best_key, ud.best_len);
+            assert(*best_key_out);
+        }
+    }
         
     return ud.best_records;
 }
@@ -2,86 +2,288 @@
 #define PATRICIA_H
 
 #include <stdbool.h>
-#include "record_struct.h"
+#include <stddef.h>
+#include <stdint.h>
+#include "recstore.h"
+#include "arena.h"
 #include "metrics.h"
 
 /* Forward declarations for Patricia Trie structures */
 struct pt_node;
 struct ptree;
-struct record_list;
+struct record_vec;
+
+/* Number of record ids a node holds without a separate array */
+#define PT_INLINE_RECORDS 2
+
+/* 
+ * Ids of the records associated with a key, in insertion order
+ * Up to PT_INLINE_RECORDS ids are held inline, more spill to an array
+ */
+typedef struct record_vec {
+    uint32_t count;             // Number of records
+    uint32_t space;             // Capacity of the spilled array, 0 while inline
+    union {
+        recordId inline_ids[PT_INLINE_RECORDS];
+        recordId *ids;
+    };
+} record_vec_t;
+
+/* Handle of a node, an index into the tree's node slabs */
+typedef uint32_t pt_handle_t;
+
+/* Handle standing for no node */
+#define PT_NO_NODE UINT32_MAX
+
+/* Nodes are allocated in slabs of 1 << PT_SLAB_SHIFT, which never move */
+#define PT_SLAB_SHIFT 12
+#define PT_SLAB_NODES (1u << PT_SLAB_SHIFT)
+
+/* 
+ * Most children of each kind of node, as in an adaptive radix tree
+ * Node4s and Node16s find a child by comparing its first byte with every
+ * child's, Node48s through a 256-byte index and Node256s directly
+ */
+#define PT_NODE4 4
+#define PT_NODE16 16
+#define PT_NODE48 48
+#define PT_NODE256 256
+
+/* Longest key the trie can hold */
+#define PT_MAX_KEY UINT16_MAX
 
 /* 
- * Linked list structure to store multiple records associated with a key
- * Each node contains a pointer to the actual data record and a next pointer
+ * Returns the key of a record, which must stay where it is while the trie is
+ * searched and can only move when records are added to the trie
  */
-typedef struct record_list {
-    struct data *rec;           // Pointer to the data record
-    struct record_list *next;   // Pointer to the next record in the list
-} record_list_t;
+typedef const char *(*pt_key_fn)(void *ud, recordId rec);
+
+/* Labels of up to PT_INLINE_LABEL characters are held in the node itself */
+#define PT_INLINE_LABEL 8
 
 /* 
  * Patricia Trie node structure
- * Each node represents a compressed path segment in the trie
+ * Each node represents a compressed path segment in the trie. Short labels
+ * are held in the node; longer ones are a slice of the key of one of the
+ * records under the node, key_rec, as every key through a node starts with
+ * the same path
  */
 typedef struct pt_node {
-    char *label;                // String label for this node (compressed path)
-    struct pt_node **children;  // Dynamic array of child node pointers
-    int child_count;            // Number of children this node has
-    bool is_terminal;           // True if this node represents the end of a key
-    record_list_t *records;     // List of records associated with this key
+    union {
+        struct {
+            recordId key_rec;   // Record whose key holds the label,
+            uint16_t label_start;   // from label_start
+        };
+        char label_chars[PT_INLINE_LABEL];  // The label, if no longer than this
+    };
+    uint32_t label_len : 16;    // Label length in characters
+    uint32_t child_count : 9;   // Number of children this node has
+    uint32_t is_terminal : 1;   // True if this node represents the end of a key
+    uint32_t first_child;       // Start of the children's handles in the tree's child array
+    record_vec_t records;       // Records associated with this key
 } pt_node_t;
 
 /* 
  * Patricia Trie structure
- * Contains a single root node that serves as the entry point to the trie
+ * Nodes live in slabs and refer to each other by handle; the children of each
+ * node are a range of handles in one array shared by the whole tree, with the
+ * first byte of each child's label alongside in child_keys. The kind of a node
+ * follows from its number of children, see PT_NODE4
  */
 typedef struct ptree {
-    pt_node_t *root;            // Root node of the Patricia Trie
+    pt_node_t *root;            // Root node of the Patricia Trie, handle 0
+    pt_node_t **slabs;          // Node slabs, allocated from the arena
+    uint32_t slab_count;
+    uint32_t node_count;        // Handles given out, including freed nodes
+    pt_handle_t free_node;      // First freed node, linked through first_child
+    pt_handle_t *child_ids;     // Children of every node, and Node48 and Node256 lookups
+    uint8_t *child_keys;        // First byte of the label of each child
+    uint32_t child_used;
+    uint32_t child_space;
+    pt_handle_t *empty_keys;    // Leaves of the empty key, see pt_insert
+    uint32_t empty_count;
+    uint32_t empty_space;
+    struct arena *arena;        // Slabs and spilled record ids
+    pt_key_fn key;              // Where the labels are held
+    void *key_ud;
 } ptree_t;
 
+/* Returns the node a handle refers to */
+static inline pt_node_t *pt_node(const ptree_t *t, pt_handle_t h){
+    return &t->slabs[h >> PT_SLAB_SHIFT][h & (PT_SLAB_NODES - 1)];
+}
+
+/* Returns the i-th child of a node */
+static inline pt_node_t *pt_child(const ptree_t *t, const pt_node_t *n, int i){
+    return pt_node(t, t->child_ids[n->first_child + i]);
+}
+
+/* Returns the label of a node, label_len characters which aren't terminated */
+static inline const char *pt_label(const ptree_t *t, const pt_node_t *n){
+    if(n->label_len <= PT_INLINE_LABEL) return n->label_chars;
+    return t->key(t->key_ud, n->key_rec) + n->label_start;
+}
+
 /* 
  * Core Patricia Trie operations
  */
 
-/* Create a new empty Patricia Trie */
-ptree_t *pt_create(void);
+/* Create a new empty Patricia Trie over records whose keys key returns */
+ptree_t *pt_create(pt_key_fn key, void *key_ud);
 
-/* Free the entire Patricia Trie and all associated memory */
+/* Free the entire Patricia Trie and all associated memory, but not the records */
 void pt_free(ptree_t *t);
 
-/* Insert a key-record pair into the Patricia Trie */
-void pt_insert(ptree_t *t, const char *key, struct data *rec);
+/* 
+ * Insert a record into the Patricia Trie under its key, keyLen bytes long
+ * key must be the text key returns for the record
+ * Each record of the empty key is a leaf of its own, and only the first is
+ * found by searching for it; these leaves are listed beside the root's
+ * children, as they have no first byte to be found by
+ */
+void pt_insert(ptree_t *t, const char *key, size_t keyLen, recordId rec);
+
+/* 
+ * Insert n records into an empty Patricia Trie at once, record i under its key
+ * keys[i], key_lens[i] bytes long, which must be the text key returns for it
+ * Builds the same trie as inserting them in order with pt_insert, from the
+ * keys sorted, creating each node once with its children in place
+ */
+void pt_bulk_load(ptree_t *t, const char *const *keys, const size_t *key_lens,
+                  const recordId *records, size_t n);
+
+/* 
+ * pt_bulk_load on up to threads threads, which builds the same trie
+ * Keys are loaded in groups by their first byte, into tries which are then
+ * joined, so key must be safe to call from several threads at once
+ */
+void pt_bulk_load_parallel(ptree_t *t, const char *const *keys, const size_t *key_lens,
+                           const recordId *records, size_t n, int threads);
+
+/* Returns true for the records pt_delete is to remove */
+typedef bool (*pt_record_pred)(recordId rec, void *ud);
+
+/* 
+ * Remove the records of the given key which pred is true for, or every record
+ * of the key if pred is NULL, keeping the rest in order. Returns how many were
+ * removed. Once the key has no records left the trie is restructured as though
+ * it had never been inserted: its node is pruned or merged with its only
+ * child, and a parent left with one child is merged with it
+ * Removed records may still hold the labels of nodes, so their keys must stay
+ * where they are
+ */
+uint32_t pt_delete(ptree_t *t, const char *key, pt_record_pred pred, void *ud);
+
+/* 
+ * Remove a record from the list of the given key, returns true if it was there
+ * The trie is restructured as for pt_delete
+ */
+bool pt_remove_record(ptree_t *t, const char *key, recordId rec);
+
+/* 
+ * Replace a record of the given key with new_rec under new_key, new_key_len
+ * bytes long, which may be the same key or record. Returns false, leaving the
+ * trie as it was, if rec wasn't under key
+ */
+bool pt_update(ptree_t *t, const char *key, recordId rec, const char *new_key,
+               size_t new_key_len, recordId new_rec);
 
 /* 
  * Search for a key in the Patricia Trie with mismatch detection
  * Returns the node where mismatch occurs or the exact match node
- * Sets *exact_terminal to true if an exact match is found at a terminal node
+ * Sets *exact_terminal to true if an exact match is found at a terminal node,
+ * and *label_start to how far into the key the returned node's label starts
+ */
+pt_node_t* pt_search_with_mismatch(ptree_t *t, const char *key, bool *exact_terminal,
+                                   size_t *label_start);
+
+/* 
+ * Length in characters of the longest common prefix of a string a_len
+ * characters long and a label b_len characters long
+ * Compares 16 or 8 bytes at a time, adding the bits a bit by bit comparison
+ * would have to g_metrics.bitCount: 8 for each matching character, those up
+ * to the first mismatching bit of the next, and 1 for the first mismatching
+ * bit (or for the end of the shorter string)
  */
-pt_node_t* pt_search_with_mismatch(ptree_t *t, const char *key, bool *exact_terminal);
+int pt_lcp_bits(const char *a, size_t a_len, const char *b, size_t b_len);
+
+/* Number of leading bytes two strings of at least n bytes share, up to n */
+size_t pt_common_prefix(const char *a, const char *b, size_t n);
+
+/* 
+ * Ids of the records in a record vector, count of them
+ * Only valid until records are next added to or removed from the trie
+ */
+const recordId *pt_record_ids(const record_vec_t *records);
+
+/* Add a record to the end of a record vector, any spilled ids are allocated from arena */
+void pt_records_push(struct arena *arena, record_vec_t *v, recordId rec);
+
+/* Remove a record from a record vector, returns true if it was there */
+bool pt_records_remove(record_vec_t *v, recordId rec);
+
+/* Label lengths are counted in buckets of powers of two: 0, 1, 2-3, 4-7, ... */
+#define PT_LABEL_BUCKETS 8
+
+/* 
+ * Memory held by a Patricia Trie, in bytes unless noted
+ * Unused bytes are allocated but hold nothing, or nothing any longer
+ */
+typedef struct pt_memory_stats {
+    uint64_t nodes;             // Nodes in the trie
+    uint64_t terminals;         // Nodes with records
+    uint64_t leaves;            // Nodes without children
+    uint64_t max_fanout;        // Most children of any node
+    uint64_t slab_count;
+    uint64_t slab_bytes;
+    uint64_t slab_unused;       // Free nodes and the unused end of the last slab
+    uint64_t label_chars;       // Total label length
+    uint64_t inline_labels;     // Labels held in their node, the rest are in the keys
+    uint64_t label_lengths[PT_LABEL_BUCKETS];  // Labels by length, the last bucket open ended
+    uint64_t child_bytes;       // The shared child array and its keys
+    uint64_t child_unused;      // Abandoned or spare ranges of them
+    uint64_t lookup_bytes;      // Node48 and Node256 lookups held in the child array
+    uint64_t node_kinds[4];     // Nodes with children by kind: Node4, 16, 48 and 256
+    uint64_t records;           // Record ids held
+    uint64_t inline_records;    // Of which held inline in the node
+    uint64_t spilled_arrays;
+    uint64_t spilled_bytes;
+    uint64_t spilled_unused;
+    struct arenaUsage arena;    // Everything allocated from the trie's arena
+} pt_memory_stats_t;
+
+/* Fill in stats with the memory held by the trie */
+void pt_memory_stats(const ptree_t *t, pt_memory_stats_t *stats);
 
 /* 
  * Callback function type for tree traversal
- * Called for each complete key found during traversal
- * Parameters: full_key (complete key string), records (associated records), ud (user data)
+ * Called for each key found during traversal
+ * Parameters: key (key_len characters, not terminated), records (associated
+ * records), ud (user data)
  */
-typedef void (*pt_visit_cb)(const char *full_key, record_list_t *records, void *ud);
+typedef void (*pt_visit_cb)(const char *key, size_t key_len, const record_vec_t *records, void *ud);
 
 /* 
- * Traverse all keys in the subtree rooted at the given node
- * Calls the callback function for each terminal node found
- * Prefix is prepended to each key found during traversal
+ * Traverse all keys in the subtree rooted at the given node, whose label
+ * starts label_start characters into its keys
+ * Calls the callback function for each terminal node found, with its key from
+ * the start of the given node's label
  */
-void pt_traverse_keys_from(pt_node_t *node, const char *prefix, pt_visit_cb cb, void *ud);
+void pt_traverse_keys_from(ptree_t *t, pt_node_t *node, size_t label_start,
+                           pt_visit_cb cb, void *ud);
 
 /* 
  * Find the most similar key in the subtree using edit distance
- * Searches all keys under mismatch_node and returns the record list
+ * Searches all keys under mismatch_node, from its label_start as returned by
+ * pt_search_with_mismatch, and returns the records
  * of the key with minimum edit distance to the query string
  * If best_key_out is not NULL, stores a copy of the best matching key
  * In case of tie in edit distance, returns lexicographically smallest key
  */
-record_list_t* pt_search_similar_under(pt_node_t *mismatch_node,
-                                       const char *query,
-                                       char **best_key_out);
+const record_vec_t* pt_search_similar_under(ptree_t *t,
+                                            pt_node_t *mismatch_node,
+                                            size_t label_start,
+                                            const char *query,
+                                            char **best_key_out);
 
 #endif
@@ -7,243 +7,567 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
 #include "read.h"
-#include "record_struct.h"
+#include "csvscan.h"
+#include "decompress.h"
 
 #define INIT_RECORDS 1
-#define NUM_FIELDS 35
 
-/* 
-Reads a line - removing trailing whitespace, returns a csvRecord or NULL
-if parsing was unsuccessful. 
-*/
-struct csvRecord *parseLine(char *line);
+/* Initial size of the window buffer of a streaming reader. */
+#define WINDOW_BYTES (1 << 16)
+
+/* How far a mapped reader moves on before releasing the pages behind it. */
+#define RELEASE_BYTES (1 << 23)
+
+/* Bytes read to check whether a file is compressed. */
+#define MAGIC_PEEK_BYTES 4
+
+/* Smallest byte range worth giving to its own thread. */
+#define MIN_CHUNK_BYTES (1 << 16)
 
 /*
-Uses the parsing structure to see if the next line from the CSV needs to
-be included.
+Reads the next non-empty row in data starting at *pos, where rows must not
+cross size. Advances *pos past the row and returns its field count, or 0 if 
+no rows remain. If atEnd is not set, data is a window onto a longer input and 
+a row running into size is incomplete, so -1 is returned with *pos left at 
+the start of the row.
 */
-void checkLine(char **line, size_t *size, FILE *csvFile, char **line2, size_t *size2);
+static int scanRow(const char *data, size_t size, size_t *pos, 
+    struct csvField *fields, int maxFields, int atEnd);
 
-struct csvRecord **readCSV(FILE *csvFile, int *n){
-    struct csvRecord **records = NULL;
-    int numRecords = 0;
-    int spaceRecords = 0;
+/*
+Peeks at the first byte of the stream, and if the data might be compressed
+returns a stream which decompresses it (closing the original with it if 
+closeIn is set). Otherwise returns the stream itself. Returns NULL if the 
+data can't be decompressed.
+*/
+static FILE *openIfCompressed(FILE *stream, int closeIn);
 
+char *getQuery(FILE *f){
     char *line = NULL;
     size_t size = 0;
+    if(getline(&line, &size, f) > 0){
+        while(strlen(line) > 0 && (line[strlen(line) - 1] == '\n' 
+                || line[strlen(line) - 1] == '\r')){
+            line[strlen(line) - 1] = '\0';
+        }
+        return line;
+    } else {
+        if(line){
+            free(line);
+        }
+        return NULL;
+    }
+}
+
+
+/* 
+A CSV file opened for zero-copy reading. Regular files are mapped into memory
+whole, anything else (pipes, sockets) is streamed through a window buffer
+which only ever holds the rows currently being read.
+*/
+struct csvReader {
+    int fd;             // Descriptor of a mapped file, -1 when streaming
+    FILE *stream;       // Source of a streaming reader, NULL when mapped
+    const char *data;   // Start of the mapping or of the window buffer
+    size_t size;        // Number of bytes available at data
+    size_t pos;         // Offset of the next unread row
+    size_t released;    // Mapped bytes before this offset have been released
+    char *buffer;       // Window buffer of a streaming reader
+    size_t capacity;    // Size of the window buffer
+    int atEOF;          // Set once a streaming reader's source is exhausted
+    int failed;         // Set if reading a streaming reader's source failed
+};
+
+/* 
+Move the unread part of a streaming reader's window to the front of the buffer
+and read more data after it, growing the buffer if it is already full. Sets 
+failed if the source can't be read, such as truncated compressed data.
+*/
+static void fillWindow(struct csvReader *reader);
+
+/* Release the pages of a mapped reader's rows which have been consumed. */
+static void releaseConsumed(struct csvReader *reader);
+
+struct csvReader *openCSV(const char *filename){
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0){
+        return NULL;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0){
+        close(fd);
+        return NULL;
+    }
+    unsigned char magic[MAGIC_PEEK_BYTES];
+    ssize_t magicLen = 0;
+    if(S_ISREG(st.st_mode)){
+        magicLen = pread(fd, magic, sizeof(magic), 0);
+    }
+    if(! S_ISREG(st.st_mode) 
+        || (magicLen > 0 && looksCompressed(magic, magicLen))){
+        /* Can't be mapped (or the mapping would be compressed), so stream
+            it instead. */
+        FILE *stream = fdopen(fd, "r");
+        assert(stream);
+        return openCSVStream(stream);
+    }
+    struct csvReader *reader = (struct csvReader *)
+        calloc(1, sizeof(struct csvReader));
+    assert(reader);
+    reader->fd = fd;
+    reader->size = (size_t) st.st_size;
+    if(reader->size > 0){
+        void *data = mmap(NULL, reader->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        assert(data != MAP_FAILED);
+        madvise(data, reader->size, MADV_SEQUENTIAL);
+        reader->data = (const char *) data;
+    }
 
     /* 
     We want to drop the header as the reading does not have that
     functionality.
     */
-    int droppedFirstLine = 0;
+    const char *headerEnd = NULL;
+    if(reader->size > 0){
+        headerEnd = memchr(reader->data, '\n', reader->size);
+    }
+    if(headerEnd){
+        reader->pos = (headerEnd - reader->data) + 1;
+    } else {
+        reader->pos = reader->size;
+    }
+    return reader;
+}
 
-    /* Used to speed up checkLine function. */
-    char *line2 = NULL;
-    size_t size2 = 0;
+static FILE *openIfCompressed(FILE *stream, int closeIn){
+    int c = getc(stream);
+    if(c == EOF){
+        return stream;
+    }
+    ungetc(c, stream);
+    unsigned char first = (unsigned char) c;
+    if(! looksCompressed(&first, 1)){
+        return stream;
+    }
+    return openDecompressed(stream, closeIn);
+}
 
-    while(getline(&line, &size, csvFile) > 0){
-        if(! droppedFirstLine){
-            droppedFirstLine = 1;
-            continue;
-        }
-        if(spaceRecords == 0){
-            records = (struct csvRecord **) 
-                malloc(sizeof(struct csvRecord *) * INIT_RECORDS);
-            assert(records);
-            spaceRecords = INIT_RECORDS;
-        } else if(numRecords >= spaceRecords){
-            spaceRecords *= 2;
-            struct csvRecord **new_records = (struct csvRecord **)
-                realloc(records, sizeof(struct csvRecord *) * spaceRecords);
-            assert(new_records);
-            records = new_records;
+struct csvReader *openCSVStream(FILE *stream){
+    stream = openIfCompressed(stream, 1);
+    if(! stream){
+        return NULL;
+    }
+    struct csvReader *reader = (struct csvReader *)
+        calloc(1, sizeof(struct csvReader));
+    assert(reader);
+    reader->fd = -1;
+    reader->stream = stream;
+    reader->capacity = WINDOW_BYTES;
+    reader->buffer = (char *) malloc(sizeof(char) * reader->capacity);
+    assert(reader->buffer);
+    reader->data = reader->buffer;
+
+    /* Drop the header, however many windows it spans. */
+    while(1){
+        const char *headerEnd = memchr(reader->data + reader->pos, '\n', 
+            reader->size - reader->pos);
+        if(headerEnd){
+            reader->pos = (headerEnd - reader->data) + 1;
+            break;
         }
-        /* If the line ends in an open double quote, we may need to extend the 
-            line. */
-        checkLine(&line, &size, csvFile, &line2, &size2);
-        records[numRecords] = parseLine(line);
-        if(records[numRecords]){
-            numRecords++;
+        reader->pos = reader->size;
+        if(reader->atEOF){
+            break;
         }
+        fillWindow(reader);
     }
-    if(line){
-        free(line);
+    return reader;
+}
+
+static void fillWindow(struct csvReader *reader){
+    size_t unread = reader->size - reader->pos;
+    memmove(reader->buffer, reader->buffer + reader->pos, unread);
+    reader->pos = 0;
+    reader->size = unread;
+    if(reader->size == reader->capacity){
+        reader->capacity *= 2;
+        reader->buffer = (char *) realloc(reader->buffer, 
+            sizeof(char) * reader->capacity);
+        assert(reader->buffer);
+        reader->data = reader->buffer;
     }
-    if(line2){
-        free(line2);
+    size_t got = fread(reader->buffer + reader->size, sizeof(char), 
+        reader->capacity - reader->size, reader->stream);
+    reader->size += got;
+    if(ferror(reader->stream)){
+        reader->failed = 1;
+        reader->atEOF = 1;
+    } else if(got == 0){
+        reader->atEOF = 1;
     }
+}
 
-    /* Shrink. */
-    struct csvRecord **new_records = (struct csvRecord **)
-                realloc(records, sizeof(struct csvRecord *) * numRecords);
-    assert(new_records);
-    records = new_records;
+static void releaseConsumed(struct csvReader *reader){
+    if(reader->pos - reader->released < RELEASE_BYTES){
+        return;
+    }
+    size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    size_t upto = (reader->pos / pageSize) * pageSize;
+    /* The pages are read only copies of the file, so dropping them is safe, 
+        touching them again just reads them back in. */
+    madvise((void *) (reader->data + reader->released), 
+        upto - reader->released, MADV_DONTNEED);
+    reader->released = upto;
+}
 
-    *n = numRecords;
-    return records;
+int nextCSVRow(struct csvReader *reader, struct csvField *fields, int maxFields){
+    if(! reader->stream){
+        /* The caller is done with the previous row's fields. */
+        releaseConsumed(reader);
+        return scanRow(reader->data, reader->size, &reader->pos, fields, 
+            maxFields, 1);
+    }
+    while(1){
+        if(reader->failed){
+            /* What was read may stop part way through a row. */
+            return -1;
+        }
+        int fieldCount = scanRow(reader->data, reader->size, &reader->pos, 
+            fields, maxFields, reader->atEOF);
+        if(fieldCount > 0 || reader->atEOF){
+            return fieldCount < 0 ? 0 : fieldCount;
+        }
+        /* The window ends part way through a row. */
+        fillWindow(reader);
+    }
 }
 
-void checkLine(char **line, size_t *size, FILE *csvFile, char **line2, size_t *size2) {
-    // char *line2 = NULL;
-    // size_t size2 = 0;
-    int lineLen = strlen(*line);
-    int progress = 0;
-    int inQuotes = 0;
-    while(progress <= lineLen) {
-        if((*line)[progress] == '\"'){
-            /* Flip inQuotes value. */
-            if(inQuotes){
-                inQuotes = 0;
+static int scanRow(const char *data, size_t size, size_t *pos, 
+    struct csvField *fields, int maxFields, int atEnd){
+    while(*pos < size){
+        size_t start = *pos;
+        size_t end = size;
+        size_t fieldStart = start;
+        int fieldNum = 0;
+        int foundEnd = 0;
+        /* For simplicity assume quotes only escape comma fields. */
+        uint64_t inQuotes = 0;
+        int sawQuote = 0;
+
+        /* Find the end of the row, noting field boundaries along the way. 
+            Line ends inside quotes belong to the field. */
+        for(size_t block = start; block < size && ! foundEnd; 
+            block += CSVSCAN_BLOCK){
+            struct csvMasks masks;
+            if(size - block >= CSVSCAN_BLOCK){
+                csvScanBlock(data + block, &masks);
             } else {
-                inQuotes = 1;
+                csvScanPartial(data + block, size - block, &masks);
             }
-        } else if ((*line)[progress] == '\0'){
-            /* If in quotes, include following line, otherwise, end of 
-                string. */
-            if(inQuotes){
-                /* CSV is malformed if there is not an end quote. */
-                assert(getline(line2, size2, csvFile) > 0);
-                size_t line2Len = strlen(*line2);
-                if((lineLen + line2Len + 1) > *size){
-                    /* line needs more space. */
-                    char *new_line = (char *) realloc(*line, sizeof(char) * (lineLen + line2Len + 1));
-                    assert(new_line);
-                    *line = new_line;
+            uint64_t escaped = csvQuoteMask(masks.quote, &inQuotes);
+            uint64_t separators = (masks.comma | masks.newline) & ~escaped;
+            uint64_t quotes = masks.quote;
+            while(separators){
+                int bit = __builtin_ctzll(separators);
+                uint64_t before = (1ULL << bit) - 1;
+                if(quotes & before){
+                    sawQuote = 1;
+                    quotes &= ~before;
                 }
-                strcat(*line, *line2);
-                lineLen = strlen(*line);
-                /* \0 is deleted from *line, so we need to decrement progress by one. */
-                progress--;
+                size_t progress = block + bit;
+                if(masks.newline & (1ULL << bit)){
+                    end = progress;
+                    foundEnd = 1;
+                    break;
+                }
+                assert(fieldNum < maxFields);
+                fields[fieldNum].offset = fieldStart;
+                fields[fieldNum].length = progress - fieldStart;
+                fields[fieldNum].quoted = sawQuote;
+                fieldNum++;
+                fieldStart = progress + 1;
+                sawQuote = 0;
+                separators &= separators - 1;
             }
+            if(! foundEnd && quotes){
+                sawQuote = 1;
+            }
+        }
+        if(! foundEnd && ! atEnd){
+            return -1;
+        }
+        /* CSV is malformed if there is not an end quote. The quote state is 
+            only meaningful here when the row runs to the end of the data. */
+        assert(foundEnd || ! inQuotes);
+        *pos = foundEnd ? end + 1 : size;
+
+        /* Remove trailing whitespace. */
+        while(end > start && (data[end - 1] == '\n' || data[end - 1] == '\r')){
+            end--;
         }
-        progress++;
+        /* Skip empty lines. */
+        if(end == start){
+            continue;
+        }
+        assert(fieldNum < maxFields && end >= fieldStart);
+        fields[fieldNum].offset = fieldStart;
+        fields[fieldNum].length = end - fieldStart;
+        fields[fieldNum].quoted = sawQuote;
+        fieldNum++;
+        return fieldNum;
     }
+    return 0;
 }
 
-/* This function reads CSVs. */
-struct csvRecord *parseLine(char *line){
-    struct csvRecord *ret = NULL;
-    char **fields = (char **) malloc(sizeof(char *) * NUM_FIELDS);
-    assert(fields);
-    int fieldNum = 0;
-    int len = strlen(line);
-    /* Remove trailing whitespace first. */
-    while(len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')){
-        line[len - 1] = '\0';
-        len--;
+/* A byte range of a mapped CSV file handled by a single thread. */
+struct csvChunk {
+    pthread_t thread;
+    struct csvReader *reader;
+    size_t start;
+    size_t end;
+    /* Quote parity of the range, found in the first pass. */
+    int parity;
+    int maxFields;
+    csvRowConverter convert;
+    void *ud;
+    /* Converted rows, in the order they appear in the range. */
+    void **items;
+    int numItems;
+    int spaceItems;
+};
+
+/* Add a converted row to the end of a chunk's items. */
+static void addChunkItem(struct csvChunk *chunk, void *item){
+    if(chunk->numItems >= chunk->spaceItems){
+        chunk->spaceItems = chunk->spaceItems ? chunk->spaceItems * 2 : INIT_RECORDS;
+        chunk->items = (void **) realloc(chunk->items, 
+            sizeof(void *) * chunk->spaceItems);
+        assert(chunk->items);
     }
-    /* Check for empty lines. */
-    if(len == 0){
-        return NULL;
+    chunk->items[chunk->numItems++] = item;
+}
+
+/* Find the quote parity of a chunk. */
+static void *chunkParity(void *arg){
+    struct csvChunk *chunk = (struct csvChunk *) arg;
+    chunk->parity = csvQuoteParity(chunk->reader->data + chunk->start, 
+        chunk->end - chunk->start, 0);
+    return NULL;
+}
+
+/* Parse and convert all rows of a chunk. */
+static void *chunkRows(void *arg){
+    struct csvChunk *chunk = (struct csvChunk *) arg;
+    struct csvField fields[chunk->maxFields];
+    size_t pos = chunk->start;
+    int fieldCount;
+    while((fieldCount = scanRow(chunk->reader->data, chunk->end, &pos, fields, 
+        chunk->maxFields, 1)) > 0){
+        addChunkItem(chunk, chunk->convert(chunk->reader, fields, fieldCount, 
+            chunk->ud));
     }
+    return NULL;
+}
 
-    int progress = 0;
-    int start = 0;
-    /* For simplicity assume quotes only escape comma fields. */
-    int inQuotes = 0;
+/*
+Returns the offset just past the first line end at or after pos which is not 
+inside quotes, given whether pos is inside quotes.
+*/
+static size_t nextRowStart(const char *data, size_t size, size_t pos, 
+    int inQuotes){
+    uint64_t carry = inQuotes ? ~0ULL : 0;
+    for(size_t block = pos; block < size; block += CSVSCAN_BLOCK){
+        struct csvMasks masks;
+        if(size - block >= CSVSCAN_BLOCK){
+            csvScanBlock(data + block, &masks);
+        } else {
+            csvScanPartial(data + block, size - block, &masks);
+        }
+        uint64_t ends = masks.newline & ~csvQuoteMask(masks.quote, &carry);
+        if(ends){
+            return block + __builtin_ctzll(ends) + 1;
+        }
+    }
+    return size;
+}
 
-    while(progress <= len){
-        if(line[progress] == '\"'){
-            if(inQuotes){
-                inQuotes = 0;
-            } else {
-                inQuotes = 1;
-            }
-        } else if(line[progress] == ',' || line[progress] == '\0'){
-            if(inQuotes){
-                /* Skip over, comma is escaped. */
-                /* Verify CSV not malformed. */
-                assert(line[progress] != '\0');
-            } else {
-                /* Check fields match expected. */
-                assert(line[progress] != '\0' || fieldNum == (NUM_FIELDS - 1));
-                /* Terminate */
-                line[progress] = '\0';
-                assert(fieldNum < NUM_FIELDS);
-                fields[fieldNum] = strdup(line + start);
-                assert(fields[fieldNum]);
-                fieldNum++;
-                start = progress + 1;
-            }
+/* Run fn over every chunk, one thread per chunk. */
+static void runChunks(struct csvChunk *chunks, int numChunks, 
+    void *(*fn)(void *)){
+    for(int i = 1; i < numChunks; i++){
+        int err = pthread_create(&chunks[i].thread, NULL, fn, &chunks[i]);
+        assert(err == 0);
+    }
+    /* The calling thread takes the first chunk itself. */
+    fn(&chunks[0]);
+    for(int i = 1; i < numChunks; i++){
+        pthread_join(chunks[i].thread, NULL);
+    }
+}
+
+void **readCSVParallel(struct csvReader *reader, int numThreads, int maxFields,
+    csvRowConverter convert, void *ud, int *n){
+    if(reader->stream){
+        /* Only whole mapped files can be split, read streams in order. */
+        struct csvField fields[maxFields];
+        struct csvChunk serial = {0};
+        int fieldCount;
+        while((fieldCount = nextCSVRow(reader, fields, maxFields)) > 0){
+            addChunkItem(&serial, convert(reader, fields, fieldCount, ud));
         }
-        progress++;
-    }
-    /* Sanity check! Did we get everything? */
-    assert(fieldNum == NUM_FIELDS);
-
-    /* Step 2: Clean extraneous quotes. */
-    for(int i = 0; i < NUM_FIELDS; i++){
-        if(strlen(fields[i]) > 0){
-            if(fields[i][0] == '\"'){
-                assert(fields[i][strlen(fields[i]) - 1] == '\"');
-                fields[i][strlen(fields[i]) - 1] = '\0';
-                int len = strlen(fields[i]);
-                for(int j = 0; j < len; j++){
-                    // Shuffle all characters along one character.
-                    fields[i][j] = fields[i][j + 1];
-                }
+        if(fieldCount < 0){
+            for(int i = 0; i < serial.numItems; i++){
+                free(serial.items[i]);
             }
+            free(serial.items);
+            *n = -1;
+            return NULL;
         }
+        *n = serial.numItems;
+        return serial.items;
     }
+    size_t start = reader->pos;
+    size_t size = reader->size;
+    size_t remaining = size - start;
 
-    /* Step 3: Reduce quote count where occuring. */
-    for(int i = 0; i < NUM_FIELDS; i++){
-        if(strlen(fields[i]) > 0){
-            /* Progress pointer - marks how much of the string has 
-                been written. */
-            int progress = 0;
-            for(int j = 0; j <= strlen(fields[i]); j++){
-                if(fields[i][j] == '\"'){
-                    /* Quotes always appear in pairs, so skip over first 
-                        quote. */
-                    j++;
-                }
-                if(j != progress){
-                    fields[i][progress] = fields[i][j];
-                }
-                progress++;
-            }
+    int numChunks = numThreads;
+    if(numChunks > remaining / MIN_CHUNK_BYTES){
+        numChunks = remaining / MIN_CHUNK_BYTES;
+    }
+    if(numChunks < 1){
+        numChunks = 1;
+    }
+
+    struct csvChunk *chunks = (struct csvChunk *) 
+        calloc(numChunks, sizeof(struct csvChunk));
+    assert(chunks);
+    for(int i = 0; i < numChunks; i++){
+        chunks[i].reader = reader;
+        chunks[i].start = start + (remaining / numChunks) * i;
+        chunks[i].end = (i == numChunks - 1) ? size : 
+            start + (remaining / numChunks) * (i + 1);
+        chunks[i].maxFields = maxFields;
+        chunks[i].convert = convert;
+        chunks[i].ud = ud;
+    }
+
+    /* Pass 1: the quote parity of every chunk tells us whether each nominal
+        split point falls inside a quoted field. */
+    if(numChunks > 1){
+        runChunks(chunks, numChunks, chunkParity);
+    }
+
+    /* Snap each split point forward to the start of the next row. */
+    int inQuotes = 0;
+    for(int i = 1; i < numChunks; i++){
+        inQuotes ^= chunks[i - 1].parity;
+        size_t split = nextRowStart(reader->data, size, chunks[i].start, 
+            inQuotes);
+        if(split < chunks[i - 1].start){
+            split = chunks[i - 1].start;
         }
+        chunks[i - 1].end = split;
+        chunks[i].start = split;
     }
 
-    ret = (struct csvRecord *) malloc(sizeof(struct csvRecord));
-    assert(ret);
-    ret->fieldCount = fieldNum;
-    ret->fields = fields;
+    /* Pass 2: parse and convert every chunk. */
+    runChunks(chunks, numChunks, chunkRows);
 
-    return ret;
+    /* Merge in file order. */
+    int total = 0;
+    for(int i = 0; i < numChunks; i++){
+        total += chunks[i].numItems;
+    }
+    void **items = (void **) malloc(sizeof(void *) * (total > 0 ? total : 1));
+    assert(items);
+    int done = 0;
+    for(int i = 0; i < numChunks; i++){
+        if(chunks[i].numItems > 0){
+            memcpy(items + done, chunks[i].items, 
+                sizeof(void *) * chunks[i].numItems);
+        }
+        done += chunks[i].numItems;
+        free(chunks[i].items);
+    }
+    free(chunks);
+
+    reader->pos = size;
+    *n = total;
+    return items;
 }
 
-char *getQuery(FILE *f){
-    char *line = NULL;
-    size_t size = 0;
-    if(getline(&line, &size, f) > 0){
-        while(strlen(line) > 0 && (line[strlen(line) - 1] == '\n' 
-                || line[strlen(line) - 1] == '\r')){
-            line[strlen(line) - 1] = '\0';
+const char *csvData(struct csvReader *reader){
+    return reader->data;
+}
+
+int csvMapped(struct csvReader *reader){
+    return reader->stream == NULL;
+}
+
+int csvSplitRow(const char *row, size_t length, struct csvField *fields, 
+    int maxFields){
+    size_t pos = 0;
+    return scanRow(row, length, &pos, fields, maxFields, 1);
+}
+
+size_t csvSliceDecode(const char *data, const struct csvField *field, 
+    char *dest){
+    const char *raw = data + field->offset;
+    size_t length = field->length;
+    if(! field->quoted){
+        /* Nothing to unescape, the slice is the value. */
+        memcpy(dest, raw, length);
+        dest[length] = '\0';
+        return length;
+    }
+
+    size_t written = 0;
+    size_t i = 0;
+    if(length > 0 && raw[0] == '\"'){
+        /* Clean extraneous quotes. */
+        assert(raw[length - 1] == '\"');
+        i = 1;
+        if(length > 1){
+            length--;
         }
-        return line;
-    } else {
-        if(line){
-            free(line);
+    }
+    while(i < length){
+        if(raw[i] == '\"'){
+            /* Quotes always appear in pairs, so skip over first quote. */
+            i++;
+            if(i == length){
+                break;
+            }
         }
-        return NULL;
+        dest[written++] = raw[i++];
     }
+    dest[written] = '\0';
+    return written;
 }
 
-void freeCSV(struct csvRecord **dataset, int n){
-    if(! dataset){
+size_t csvFieldDecode(struct csvReader *reader, const struct csvField *field,
+    char *dest){
+    return csvSliceDecode(reader->data, field, dest);
+}
+
+void closeCSV(struct csvReader *reader){
+    if(! reader){
         return;
     }
-    for(int i = 0; i < n; i++){
-        for(int j = 0; j < dataset[i]->fieldCount; j++){
-            free(dataset[i]->fields[j]);
+    if(reader->stream){
+        fclose(reader->stream);
+        free(reader->buffer);
+    } else {
+        if(reader->data){
+            munmap((void *) reader->data, reader->size);
         }
-        free(dataset[i]->fields);
-        free(dataset[i]);
+        close(reader->fd);
     }
-    free(dataset);
+    free(reader);
 }
-
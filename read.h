@@ -1,17 +1,99 @@
-/* 
-    Data structure declarations and prototypes for a 
+/*
+    Data structure declarations and prototypes for a
     csv parsing module intended to convert from CSV files
     into C strings.
 */
-#include "record_struct.h"
+#ifndef READ_H
+#define READ_H
+
 #include <stdio.h>
+#include <stddef.h>
 
-/* Returns a list of CSV records. */
-struct csvRecord **readCSV(FILE *csvFile, int *n);
+/* 
+    gzip and zstd compressed input is recognised by its first bytes, and 
+    decompressed on a separate thread as it is read.
+*/
 
 /* Read a line of input from the given file. */
 char *getQuery(FILE *f);
 
-/* Free a set of records. */
-void freeCSV(struct csvRecord **dataset, int n);
+/*
+    Zero-copy CSV reading. The file is mapped into memory and each field of a
+    row is described as a slice of the mapping rather than copied out. Fields
+    only need decoding when they contain quote characters. Inputs which can't
+    be mapped are streamed through a small window buffer instead. Either way
+    rows are handed out one at a time, so a row's fields only need to stay 
+    valid until the next row is read, and already read data is released as 
+    reading goes on.
+*/
+
+/* A single field of a row, described as a slice of the reader's data. */
+struct csvField {
+    size_t offset;      // Offset of the raw field text from the start of the data
+    size_t length;      // Length of the raw field text in bytes
+    int quoted;         // Non-zero if the raw text contains a quote character
+};
+
+/* A CSV file opened for zero-copy reading. */
+struct csvReader;
+
+/* Open and map the given CSV file, skipping its header row. Files which are
+    not regular files, or are compressed, are streamed. Returns NULL if the 
+    file cannot be opened. */
+struct csvReader *openCSV(const char *filename);
+
+/* Read CSV data from an already open stream, skipping its header row. The 
+    reader takes ownership of the stream and closes it in closeCSV. Returns 
+    NULL if the stream is compressed in a format that can't be read. */
+struct csvReader *openCSVStream(FILE *stream);
+
+/* Reads the next non-empty row into fields (which must hold at least
+    maxFields entries). Returns the number of fields read, 0 when no rows 
+    remain, or -1 if the data can't be read (such as truncated compressed 
+    data). The fields are only valid until the next call. */
+int nextCSVRow(struct csvReader *reader, struct csvField *fields, int maxFields);
+
+/* Returns the start of the reader's data, the base of all field offsets. 
+    For a streaming reader this moves as rows are read. */
+const char *csvData(struct csvReader *reader);
+
+/* Returns non-zero if the reader's data is a mapping of the whole file, so
+    field offsets stay valid until the reader is closed. */
+int csvMapped(struct csvReader *reader);
+
+/* Splits a single raw row of length bytes (as delimited by the first and last
+    field of a row read earlier) into fields, with offsets relative to row. 
+    Returns the number of fields. */
+int csvSplitRow(const char *row, size_t length, struct csvField *fields, 
+    int maxFields);
+
+/* Writes the text of the field sliced from data to dest, stripping 
+    surrounding quotes and reducing doubled quotes. dest must have space for
+    field->length + 1 bytes. Returns the length of the decoded text. */
+size_t csvSliceDecode(const char *data, const struct csvField *field, 
+    char *dest);
+
+/* Writes the decoded text of the field to dest, which must have space for
+    field->length + 1 bytes. Returns the length of the decoded text. */
+size_t csvFieldDecode(struct csvReader *reader, const struct csvField *field,
+    char *dest);
+
+/* Converts the fields of a row into an item. Called from worker threads, so 
+    must be safe to call concurrently. */
+typedef void *(*csvRowConverter)(struct csvReader *reader, 
+    struct csvField *fields, int fieldCount, void *ud);
+
+/* Reads all remaining rows using numThreads worker threads. The data is split
+    into byte ranges which are snapped to row boundaries (respecting quoted 
+    line ends), each range is parsed and converted on its own thread, and the
+    items are returned in file order. The number of items is stored in n. 
+    Streaming readers can't be split and are read on the calling thread. If
+    the data can't be read (see nextCSVRow), the items converted so far are
+    freed with free, NULL is returned and n is set to -1. */
+void **readCSVParallel(struct csvReader *reader, int numThreads, int maxFields,
+    csvRowConverter convert, void *ud, int *n);
+
+/* Unmap and free the reader. */
+void closeCSV(struct csvReader *reader);
 
+#endif
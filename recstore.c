@@ -0,0 +1,1061 @@
+/*
+ * Columnar record store implementation
+ * Holds each field of every record in an array of its own, parsing numeric
+ * fields once as records are added
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include "recstore.h"
+#include "intern.h"
+
+#define INIT_RECORDS 1024
+#define INIT_HEAP (1 << 16)
+#define INIT_EXCEPTIONS 16
+#define INIT_PFI_SLOTS 1024
+#define STORE_ALIGN 8
+#define NUMERIC_BASE 10
+
+/* COLUMN_INT values which aren't numbers */
+#define INT_EMPTY INT32_MIN          // The field is empty
+#define INT_TEXT (INT32_MIN + 1)     // The text is held as an exception
+
+/* COLUMN_NUMBER formats other than a number of decimals */
+#define NUMBER_EMPTY UINT8_MAX       // The field is empty
+#define NUMBER_TEXT (UINT8_MAX - 1)  // The text is held as an exception
+#define MAX_DECIMALS 30
+
+/* How each field is held, COLUMN_STRING unless given */
+static const int columnKinds[STORE_NUM_FIELDS] = {
+    [0] = COLUMN_INT,      // PFI
+    [3] = COLUMN_CODED,    // PROPSTATUS
+    [4] = COLUMN_CODED,    // GCODEFEAT
+    [9] = COLUMN_NUMBER,   // BUNIT_ID1
+    [12] = COLUMN_NUMBER,  // BUNIT_ID2
+    [15] = COLUMN_NUMBER,  // FLOOR_NO_1
+    [16] = COLUMN_NUMBER,  // FLOOR_NO_2
+    [20] = COLUMN_NUMBER,  // HSE_NUM1
+    [23] = COLUMN_NUMBER,  // HSE_NUM2
+    [25] = COLUMN_NUMBER,  // DISP_NUM1
+    [27] = COLUMN_CODED,   // ROAD_TYPE
+    [29] = COLUMN_CODED,   // LOCALITY
+    [30] = COLUMN_CODED,   // STATE
+    [31] = COLUMN_CODED,   // POSTCODE
+    [32] = COLUMN_CODED,   // ACCESSTYPE
+    [33] = COLUMN_DOUBLE,  // x
+    [34] = COLUMN_DOUBLE,  // y
+};
+
+/* A single column, only the arrays for its kind are used */
+struct storeColumn {
+    uint32_t *offsets;           // COLUMN_STRING, text in the heap
+    uint32_t *lengths;
+    columnCode *codes;           // COLUMN_CODED, or COLUMN_NO_CODE for text
+    struct columnDict *dict;
+    int32_t *ints;               // COLUMN_INT
+    double *values;              // COLUMN_NUMBER and COLUMN_DOUBLE
+    uint8_t *formats;            // COLUMN_NUMBER, decimals or NUMBER_ sentinel
+};
+
+/*
+ * Text of a numeric field which doesn't come back the same from its value,
+ * or of a coded field whose column ran out of codes
+ * Exceptions are kept sorted by record and field
+ */
+struct storeException {
+    recordId id;
+    uint32_t field;
+    uint32_t offset;             // Text in the heap
+    uint32_t length;
+};
+
+struct recordStore {
+    uint32_t count;
+    uint32_t space;
+    uint32_t references;         // Holders of the store, see storeShare
+    struct storeColumn columns[STORE_NUM_FIELDS];
+    char *heap;
+    uint64_t heapUsed;
+    uint64_t heapSpace;
+    struct storeException *exceptions;
+    uint32_t exceptionCount;
+    uint32_t exceptionSpace;
+    int mapped;                  // Arrays point into a mapping owned elsewhere
+
+    /* Retired records and the PFI index, neither of which are written */
+    uint8_t *retired;            // By id, NULL until a record is retired
+    uint32_t retiredSpace;
+    struct pfiSlot *pfiSlots;    // NULL until the index is first used
+    uint32_t pfiSpace;           // Always a power of two
+    uint32_t pfiCount;
+
+    /* Lazy stores, only the key column is filled in */
+    struct csvReader *reader;    // Source of the rows, NULL unless lazy
+    int cacheRows;
+    uint64_t *rowOffsets;        // Raw row text within the reader's data
+    uint32_t *rowLengths;
+    a2_data **cache;             // Decoded rows by id, if cacheRows is set
+    a2_data *current;            // Last row decoded, if not cached
+    recordId currentId;
+};
+
+/* Entry of the PFI index, which is open addressed with linear probing */
+struct pfiSlot {
+    uint64_t hash;
+    recordId id;                 // STORE_NO_RECORD if the slot is free
+};
+
+/*
+ * Store as written by storeWrite
+ * Offsets are from the start of the header, arrays hold count entries
+ */
+struct storeFileColumn {
+    uint32_t kind;
+    uint32_t valueCount;         // COLUMN_CODED, number of distinct values
+    uint64_t first;              // offsets, codes, ints or values
+    uint64_t second;             // lengths, the coded values or formats
+    uint64_t secondBytes;
+};
+
+struct storeFileHeader {
+    uint32_t count;
+    uint32_t fieldCount;         // STORE_NUM_FIELDS
+    uint32_t exceptionCount;
+    uint32_t reserved;
+    uint64_t heapOffset;
+    uint64_t heapBytes;
+    uint64_t exceptionsOffset;
+    uint64_t size;               // Bytes in the whole store
+    struct storeFileColumn columns[STORE_NUM_FIELDS];
+};
+
+int storeColumnKind(int field){
+    assert(field >= 0 && field < STORE_NUM_FIELDS);
+    return columnKinds[field];
+}
+
+struct recordStore *newRecordStore(void){
+    struct recordStore *s = calloc(1, sizeof(struct recordStore));
+    assert(s);
+    s->references = 1;
+    for(int i = 0; i < STORE_NUM_FIELDS; i++){
+        if(columnKinds[i] == COLUMN_CODED){
+            s->columns[i].dict = newColumnDict();
+        }
+    }
+    return s;
+}
+
+struct recordStore *newLazyRecordStore(struct csvReader *reader, int cacheRows){
+    assert(reader && csvMapped(reader));
+    struct recordStore *s = calloc(1, sizeof(struct recordStore));
+    assert(s);
+    s->references = 1;
+    s->reader = reader;
+    s->cacheRows = cacheRows;
+    return s;
+}
+
+int storeIsLazy(struct recordStore *s){
+    return s->reader != NULL;
+}
+
+struct recordStore *storeShare(struct recordStore *s){
+    s->references++;
+    return s;
+}
+
+int storeIsShared(struct recordStore *s){
+    return s->references > 1;
+}
+
+uint32_t storeRecordCount(struct recordStore *s){
+    return s->count;
+}
+
+/* Bytes each record takes in a column of the given kind */
+static size_t columnEntryBytes(int kind){
+    switch(kind){
+        case COLUMN_CODED:
+            return sizeof(columnCode);
+        case COLUMN_STRING:
+            return 2 * sizeof(uint32_t);
+        case COLUMN_INT:
+            return sizeof(int32_t);
+        case COLUMN_NUMBER:
+            return sizeof(uint8_t) + sizeof(double);
+        default:
+            return sizeof(double);
+    }
+}
+
+void storeMemoryStats(struct recordStore *s, struct storeMemory *m){
+    memset(m, 0, sizeof(struct storeMemory));
+    m->records = s->count;
+    m->mapped = s->mapped;
+    for(recordId id = 0; id < s->retiredSpace && id < s->count; id++){
+        m->retired += s->retired[id];
+    }
+    for(int i = 0; i < STORE_NUM_FIELDS; i++){
+        if(s->reader && i != STORE_KEY_FIELD){
+            continue;
+        }
+        size_t entry = columnEntryBytes(columnKinds[i]);
+        m->columnBytes[columnKinds[i]] += entry * s->count;
+        m->columnUnused += entry * (s->space - s->count);
+        if(columnKinds[i] == COLUMN_CODED){
+            m->codedValues += columnValueCount(s->columns[i].dict);
+        }
+    }
+    m->heapBytes = s->heapSpace;
+    m->heapUnused = s->heapSpace - s->heapUsed;
+    m->exceptions = s->exceptionCount;
+    m->exceptionBytes = sizeof(struct storeException) * s->exceptionSpace;
+    m->exceptionUnused = sizeof(struct storeException)
+        * (s->exceptionSpace - s->exceptionCount);
+    m->indexBytes = sizeof(struct pfiSlot) * (uint64_t) s->pfiSpace
+        + s->retiredSpace;
+    if(s->reader){
+        m->lazyBytes = (sizeof(uint64_t) + sizeof(uint32_t)) * (uint64_t) s->space;
+        if(s->cacheRows){
+            m->lazyBytes += sizeof(a2_data *) * (uint64_t) s->space;
+            for(recordId id = 0; id < s->count; id++){
+                m->cachedRows += s->cache[id] != NULL;
+            }
+        }
+    }
+}
+
+/* Resize an array of count entries of size bytes to space entries */
+static void *resizeArray(void *array, size_t space, size_t size){
+    array = realloc(array, space * size);
+    assert(array);
+    return array;
+}
+
+/* Make room for one more record in every column */
+static void reserveRecord(struct recordStore *s){
+    assert(! s->mapped && s->count < UINT32_MAX);
+    if(s->count < s->space){
+        return;
+    }
+    uint32_t space = s->space ? s->space * 2 : INIT_RECORDS;
+    if(space < s->space){
+        space = UINT32_MAX;
+    }
+    for(int i = 0; i < STORE_NUM_FIELDS; i++){
+        struct storeColumn *c = &s->columns[i];
+        if(s->reader && i != STORE_KEY_FIELD){
+            /* Lazy stores only hold the key, which is always text. */
+            continue;
+        }
+        switch(columnKinds[i]){
+            case COLUMN_CODED:
+                c->codes = resizeArray(c->codes, space, sizeof(columnCode));
+                break;
+            case COLUMN_STRING:
+                c->offsets = resizeArray(c->offsets, space, sizeof(uint32_t));
+                c->lengths = resizeArray(c->lengths, space, sizeof(uint32_t));
+                break;
+            case COLUMN_INT:
+                c->ints = resizeArray(c->ints, space, sizeof(int32_t));
+                break;
+            case COLUMN_NUMBER:
+                c->formats = resizeArray(c->formats, space, sizeof(uint8_t));
+                c->values = resizeArray(c->values, space, sizeof(double));
+                break;
+            case COLUMN_DOUBLE:
+                c->values = resizeArray(c->values, space, sizeof(double));
+                break;
+        }
+    }
+    if(s->reader){
+        s->rowOffsets = resizeArray(s->rowOffsets, space, sizeof(uint64_t));
+        s->rowLengths = resizeArray(s->rowLengths, space, sizeof(uint32_t));
+        if(s->cacheRows){
+            s->cache = resizeArray(s->cache, space, sizeof(a2_data *));
+            memset(s->cache + s->space, 0, sizeof(a2_data *) * (space - s->space));
+        }
+    }
+    s->space = space;
+}
+
+/* Make room for length bytes and a terminator at the end of the heap */
+static char *reserveHeap(struct recordStore *s, size_t length){
+    assert(s->heapUsed + length + 1 <= UINT32_MAX);
+    if(s->heapUsed + length + 1 > s->heapSpace){
+        uint64_t space = s->heapSpace ? s->heapSpace : INIT_HEAP;
+        while(s->heapUsed + length + 1 > space){
+            space *= 2;
+        }
+        s->heap = resizeArray(s->heap, space, sizeof(char));
+        s->heapSpace = space;
+    }
+    return s->heap + s->heapUsed;
+}
+
+/* Finish off text of length bytes written at the end of the heap by
+    reserveHeap, returning its offset */
+static uint32_t commitHeap(struct recordStore *s, size_t length){
+    uint32_t offset = (uint32_t) s->heapUsed;
+    s->heap[offset + length] = '\0';
+    s->heapUsed += length + 1;
+    return offset;
+}
+
+/* Keep the text of a numeric field which its value can't reproduce */
+static void addException(struct recordStore *s, recordId id, int field,
+    const char *text, size_t length){
+    if(s->exceptionCount == s->exceptionSpace){
+        s->exceptionSpace = s->exceptionSpace ? s->exceptionSpace * 2
+            : INIT_EXCEPTIONS;
+        s->exceptions = resizeArray(s->exceptions, s->exceptionSpace,
+            sizeof(struct storeException));
+    }
+    struct storeException *e = &s->exceptions[s->exceptionCount++];
+    e->id = id;
+    e->field = (uint32_t) field;
+    memcpy(reserveHeap(s, length), text, length);
+    e->offset = commitHeap(s, length);
+    e->length = (uint32_t) length;
+}
+
+/* Find the exception holding the text of a field */
+static struct storeException *findException(struct recordStore *s, recordId id,
+    int field){
+    uint32_t low = 0;
+    uint32_t high = s->exceptionCount;
+    while(low < high){
+        uint32_t mid = low + (high - low) / 2;
+        struct storeException *e = &s->exceptions[mid];
+        if(e->id < id || (e->id == id && e->field < (uint32_t) field)){
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    assert(low < s->exceptionCount && s->exceptions[low].id == id
+        && s->exceptions[low].field == (uint32_t) field);
+    return &s->exceptions[low];
+}
+
+/* Returns non-zero if the formatted text of a number is exactly text */
+static int formatsAs(const char *formatted, int n, const char *text,
+    size_t length){
+    return n >= 0 && n < STORE_TEXT_CHARS && (size_t) n == length
+        && memcmp(formatted, text, length) == 0;
+}
+
+/* Parse the NUL terminated text of a COLUMN_INT field, returning INT_TEXT if
+    printing the value wouldn't give back the same text */
+static int32_t parseInt(const char *text, size_t length){
+    if(length == 0){
+        return INT_EMPTY;
+    }
+    char *end;
+    errno = 0;
+    long value = strtol(text, &end, NUMERIC_BASE);
+    if(errno || end != text + length || value <= INT_TEXT || value > INT32_MAX){
+        return INT_TEXT;
+    }
+    char formatted[STORE_TEXT_CHARS];
+    int n = snprintf(formatted, sizeof(formatted), "%ld", value);
+    if(! formatsAs(formatted, n, text, length)){
+        return INT_TEXT;
+    }
+    return (int32_t) value;
+}
+
+/* Parse the NUL terminated text of a COLUMN_NUMBER field into its value and
+    the decimals it was written with, or NUMBER_TEXT if printing the value
+    with those decimals wouldn't give back the same text */
+static uint8_t parseNumber(const char *text, size_t length, double *value){
+    *value = 0;
+    if(length == 0){
+        return NUMBER_EMPTY;
+    }
+    char *end;
+    *value = strtod(text, &end);
+    if(end != text + length){
+        return NUMBER_TEXT;
+    }
+    const char *point = memchr(text, '.', length);
+    size_t decimals = point ? length - (point - text) - 1 : 0;
+    if(decimals > MAX_DECIMALS){
+        return NUMBER_TEXT;
+    }
+    char formatted[STORE_TEXT_CHARS];
+    int n = snprintf(formatted, sizeof(formatted), "%.*f", (int) decimals,
+        *value);
+    if(! formatsAs(formatted, n, text, length)){
+        return NUMBER_TEXT;
+    }
+    return (uint8_t) decimals;
+}
+
+/* Set a field of a new record from its NUL terminated text */
+static void setField(struct recordStore *s, recordId id, int field,
+    const char *text, size_t length){
+    struct storeColumn *c = &s->columns[field];
+    switch(columnKinds[field]){
+        case COLUMN_STRING:
+            memcpy(reserveHeap(s, length), text, length);
+            c->offsets[id] = commitHeap(s, length);
+            c->lengths[id] = (uint32_t) length;
+            break;
+        case COLUMN_CODED:
+            /* Values past the last code are held like text. */
+            c->codes[id] = columnEncode(c->dict, text, length);
+            if(c->codes[id] == COLUMN_NO_CODE){
+                addException(s, id, field, text, length);
+            }
+            break;
+        case COLUMN_INT:
+            c->ints[id] = parseInt(text, length);
+            if(c->ints[id] == INT_TEXT){
+                addException(s, id, field, text, length);
+            }
+            break;
+        case COLUMN_NUMBER:
+            c->formats[id] = parseNumber(text, length, &c->values[id]);
+            if(c->formats[id] == NUMBER_TEXT){
+                addException(s, id, field, text, length);
+            }
+            break;
+        case COLUMN_DOUBLE:
+            c->values[id] = strtod(text, NULL);
+            break;
+    }
+}
+
+/* Returns the decoded row of a lazy store's record */
+static a2_data *lazyRow(struct recordStore *s, recordId id){
+    if(s->cacheRows && s->cache[id]){
+        return s->cache[id];
+    }
+    if(s->current && s->currentId == id){
+        return s->current;
+    }
+    a2_data *row = a2_from_row(csvData(s->reader) + s->rowOffsets[id],
+        s->rowLengths[id]);
+    if(s->cacheRows){
+        s->cache[id] = row;
+    } else {
+        a2_free(s->current);
+        s->current = row;
+        s->currentId = id;
+    }
+    return row;
+}
+
+/* FNV-1a hash of a PFI, its value unless it has to be held as text */
+static uint64_t hashPfi(int32_t value, const char *text, size_t length){
+    uint64_t hash = 14695981039346656037ULL;
+    if(value != INT_TEXT){
+        text = (const char *) &value;
+        length = sizeof(value);
+    }
+    for(size_t i = 0; i < length; i++){
+        hash = (hash ^ (unsigned char) text[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/* Returns the PFI of a record as held in a COLUMN_INT, setting text to its
+    text if that is INT_TEXT */
+static int32_t recordPfi(struct recordStore *s, recordId id, const char **text,
+    unsigned int *length){
+    if(s->reader){
+        /* Only the key of lazy records is held, parse the PFI from its row. */
+        a2_data *row = lazyRow(s, id);
+        *text = row->fields[STORE_PFI_FIELD];
+        *length = row->lengths[STORE_PFI_FIELD];
+        return parseInt(*text, *length);
+    }
+    int32_t value = s->columns[STORE_PFI_FIELD].ints[id];
+    if(value == INT_TEXT){
+        struct storeException *e = findException(s, id, STORE_PFI_FIELD);
+        *text = s->heap + e->offset;
+        *length = e->length;
+    }
+    return value;
+}
+
+/* Returns the slot holding the PFI, or the free slot where it would go */
+static struct pfiSlot *findPfiSlot(struct recordStore *s, int32_t value,
+    const char *text, size_t length, uint64_t hash){
+    uint32_t mask = s->pfiSpace - 1;
+    for(uint32_t i = (uint32_t) hash & mask; ; i = (i + 1) & mask){
+        struct pfiSlot *slot = &s->pfiSlots[i];
+        if(slot->id == STORE_NO_RECORD){
+            return slot;
+        }
+        if(slot->hash != hash){
+            continue;
+        }
+        const char *slotText;
+        unsigned int slotLength;
+        if(recordPfi(s, slot->id, &slotText, &slotLength) == value
+            && (value != INT_TEXT || (slotLength == length
+                && memcmp(slotText, text, length) == 0))){
+            return slot;
+        }
+    }
+}
+
+/* Allocate space free slots for the PFI index, moving any existing entries */
+static void resizePfiIndex(struct recordStore *s, uint32_t space){
+    struct pfiSlot *old = s->pfiSlots;
+    uint32_t oldSpace = s->pfiSpace;
+    s->pfiSlots = malloc(sizeof(struct pfiSlot) * space);
+    assert(s->pfiSlots);
+    s->pfiSpace = space;
+    for(uint32_t i = 0; i < space; i++){
+        s->pfiSlots[i].id = STORE_NO_RECORD;
+    }
+    /* PFIs are unique within the index, so entries only need a free slot. */
+    for(uint32_t i = 0; i < oldSpace; i++){
+        if(old[i].id == STORE_NO_RECORD){
+            continue;
+        }
+        uint32_t j = (uint32_t) old[i].hash & (space - 1);
+        while(s->pfiSlots[j].id != STORE_NO_RECORD){
+            j = (j + 1) & (space - 1);
+        }
+        s->pfiSlots[j] = old[i];
+    }
+    free(old);
+}
+
+/* Returns the slot of the PFI index for a record's PFI */
+static struct pfiSlot *findRecordSlot(struct recordStore *s, recordId id,
+    uint64_t *hash){
+    const char *text = NULL;
+    unsigned int length = 0;
+    int32_t value = recordPfi(s, id, &text, &length);
+    *hash = hashPfi(value, text, length);
+    /* A lazy record's text is in its decoded row, which probing decodes the
+        rows of other records over. */
+    char copy[length + 1];
+    if(length > 0){
+        memcpy(copy, text, length);
+    }
+    return findPfiSlot(s, value, copy, length, *hash);
+}
+
+/* Point the PFI index at a record, replacing any earlier one with its PFI */
+static void indexRecord(struct recordStore *s, recordId id){
+    if(! s->pfiSlots){
+        return;
+    }
+    if((uint64_t) (s->pfiCount + 1) * 2 > s->pfiSpace){
+        resizePfiIndex(s, s->pfiSpace * 2);
+    }
+    uint64_t hash;
+    struct pfiSlot *slot = findRecordSlot(s, id, &hash);
+    if(slot->id == STORE_NO_RECORD){
+        s->pfiCount++;
+    }
+    slot->hash = hash;
+    slot->id = id;
+}
+
+/* Remove a slot from the PFI index, moving back any later entries of its
+    probe run so none of them become unreachable */
+static void unindexSlot(struct recordStore *s, struct pfiSlot *slot){
+    uint32_t mask = s->pfiSpace - 1;
+    uint32_t hole = (uint32_t) (slot - s->pfiSlots);
+    for(uint32_t i = (hole + 1) & mask; s->pfiSlots[i].id != STORE_NO_RECORD;
+        i = (i + 1) & mask){
+        uint32_t home = (uint32_t) s->pfiSlots[i].hash & mask;
+        /* Entries whose home lies cyclically in (hole, i] stay put. */
+        if(((i - home) & mask) >= ((i - hole) & mask)){
+            s->pfiSlots[hole] = s->pfiSlots[i];
+            hole = i;
+        }
+    }
+    s->pfiSlots[hole].id = STORE_NO_RECORD;
+    s->pfiCount--;
+}
+
+/* Add the key of a lazy store's record, decoded straight into the heap, and
+    remember where its row lies */
+static recordId addLazyFields(struct recordStore *s, struct csvReader *reader,
+    struct csvField *fields, int fieldCount){
+    assert(reader == s->reader);
+    reserveRecord(s);
+    recordId id = s->count++;
+    struct csvField *key = &fields[STORE_KEY_FIELD];
+    struct csvField *last = &fields[fieldCount - 1];
+    struct storeColumn *c = &s->columns[STORE_KEY_FIELD];
+
+    size_t length = csvFieldDecode(reader, key, reserveHeap(s, key->length));
+    c->offsets[id] = commitHeap(s, length);
+    c->lengths[id] = (uint32_t) length;
+    s->rowOffsets[id] = fields[0].offset;
+    s->rowLengths[id] = (uint32_t) (last->offset + last->length - fields[0].offset);
+    indexRecord(s, id);
+    return id;
+}
+
+recordId storeAddFields(struct recordStore *s, struct csvReader *reader,
+    struct csvField *fields, int fieldCount){
+    assert(fieldCount == STORE_NUM_FIELDS);
+    if(s->reader){
+        return addLazyFields(s, reader, fields, fieldCount);
+    }
+    reserveRecord(s);
+    recordId id = s->count++;
+
+    size_t longest = 0;
+    for(int i = 0; i < STORE_NUM_FIELDS; i++){
+        if(fields[i].length > longest){
+            longest = fields[i].length;
+        }
+    }
+    char value[longest + 1];
+    for(int i = 0; i < STORE_NUM_FIELDS; i++){
+        if(columnKinds[i] == COLUMN_STRING){
+            /* Decoded straight into the heap, saving a copy. */
+            struct storeColumn *c = &s->columns[i];
+            size_t length = csvFieldDecode(reader, &fields[i],
+                reserveHeap(s, fields[i].length));
+            c->offsets[id] = commitHeap(s, length);
+            c->lengths[id] = (uint32_t) length;
+            continue;
+        }
+        size_t length = csvFieldDecode(reader, &fields[i], value);
+        setField(s, id, i, value, length);
+    }
+    indexRecord(s, id);
+    return id;
+}
+
+recordId storeAddRow(struct recordStore *s, a2_data *row){
+    assert(! s->reader);
+    reserveRecord(s);
+    recordId id = s->count++;
+    for(int i = 0; i < STORE_NUM_FIELDS; i++){
+        setField(s, id, i, row->fields[i], row->lengths[i]);
+    }
+    indexRecord(s, id);
+    return id;
+}
+
+const char *storeKey(struct recordStore *s, recordId id, unsigned int *length){
+    assert(id < s->count);
+    struct storeColumn *c = &s->columns[STORE_KEY_FIELD];
+    *length = c->lengths[id];
+    return s->heap + c->offsets[id];
+}
+
+const char *storeText(struct recordStore *s, recordId id, int field,
+    char *buf, unsigned int *length){
+    assert(id < s->count && field >= 0 && field < STORE_NUM_FIELDS);
+    if(s->reader && field != STORE_KEY_FIELD){
+        a2_data *row = lazyRow(s, id);
+        *length = row->lengths[field];
+        return row->fields[field];
+    }
+
+    struct storeColumn *c = &s->columns[field];
+    int n = 0;
+    switch(columnKinds[field]){
+        case COLUMN_CODED: {
+            if(c->codes[id] == COLUMN_NO_CODE){
+                break;
+            }
+            size_t valueLength;
+            const char *value = columnDecode(c->dict, c->codes[id], &valueLength);
+            *length = valueLength;
+            return value;
+        }
+        case COLUMN_STRING:
+            *length = c->lengths[id];
+            return s->heap + c->offsets[id];
+        case COLUMN_INT:
+            if(c->ints[id] == INT_TEXT){
+                break;
+            }
+            if(c->ints[id] == INT_EMPTY){
+                buf[0] = '\0';
+            } else {
+                n = snprintf(buf, STORE_TEXT_CHARS, "%d", (int) c->ints[id]);
+            }
+            *length = n;
+            return buf;
+        case COLUMN_NUMBER:
+            if(c->formats[id] == NUMBER_TEXT){
+                break;
+            }
+            if(c->formats[id] == NUMBER_EMPTY){
+                buf[0] = '\0';
+            } else {
+                n = snprintf(buf, STORE_TEXT_CHARS, "%.*f", (int) c->formats[id],
+                    c->values[id]);
+            }
+            *length = n;
+            return buf;
+        case COLUMN_DOUBLE:
+            n = snprintf(buf, STORE_TEXT_CHARS, "%.17g", c->values[id]);
+            *length = n;
+            return buf;
+    }
+    struct storeException *e = findException(s, id, field);
+    *length = e->length;
+    return s->heap + e->offset;
+}
+
+double storeDouble(struct recordStore *s, recordId id, int field){
+    assert(id < s->count && field >= 0 && field < STORE_NUM_FIELDS);
+    struct storeColumn *c = &s->columns[field];
+    if(! s->reader){
+        switch(columnKinds[field]){
+            case COLUMN_INT:
+                if(c->ints[id] == INT_EMPTY){
+                    return 0;
+                } else if(c->ints[id] != INT_TEXT){
+                    return c->ints[id];
+                }
+                break;
+            case COLUMN_NUMBER:
+                if(c->formats[id] != NUMBER_TEXT){
+                    return c->values[id];
+                }
+                break;
+            case COLUMN_DOUBLE:
+                return c->values[id];
+        }
+    }
+    /* Anything else has to be parsed from its text. */
+    char buf[STORE_TEXT_CHARS];
+    unsigned int length;
+    return strtod(storeText(s, id, field, buf, &length), NULL);
+}
+
+void storeRetire(struct recordStore *s, recordId id){
+    assert(id < s->count);
+    if(id >= s->retiredSpace){
+        uint32_t space = s->space > s->count ? s->space : s->count;
+        s->retired = resizeArray(s->retired, space, sizeof(uint8_t));
+        memset(s->retired + s->retiredSpace, 0, space - s->retiredSpace);
+        s->retiredSpace = space;
+    }
+    if(s->retired[id]){
+        return;
+    }
+    s->retired[id] = 1;
+
+    if(s->pfiSlots){
+        uint64_t hash;
+        struct pfiSlot *slot = findRecordSlot(s, id, &hash);
+        if(slot->id == id){
+            unindexSlot(s, slot);
+        }
+    }
+}
+
+int storeIsRetired(struct recordStore *s, recordId id){
+    assert(id < s->count);
+    return id < s->retiredSpace && s->retired[id];
+}
+
+recordId storeFindPfi(struct recordStore *s, const char *pfi, size_t length){
+    if(! s->pfiSlots){
+        uint32_t space = INIT_PFI_SLOTS;
+        while(space < (uint64_t) s->count * 2){
+            space *= 2;
+        }
+        resizePfiIndex(s, space);
+        for(recordId id = 0; id < s->count; id++){
+            if(! storeIsRetired(s, id)){
+                indexRecord(s, id);
+            }
+        }
+    }
+    char text[length + 1];
+    memcpy(text, pfi, length);
+    text[length] = '\0';
+    int32_t value = parseInt(text, length);
+    return findPfiSlot(s, value, text, length, hashPfi(value, text, length))->id;
+}
+
+/* Write bytes of data to f at target, padding with zeros from *pos */
+static void writeAt(FILE *f, uint64_t *pos, uint64_t target, const void *data,
+    uint64_t bytes){
+    static const char zeros[STORE_ALIGN];
+    assert(target >= *pos && target - *pos < STORE_ALIGN);
+    fwrite(zeros, 1, target - *pos, f);
+    if(bytes > 0){
+        fwrite(data, 1, bytes, f);
+    }
+    *pos = target + bytes;
+}
+
+/* Round n up to the next array boundary */
+static uint64_t alignArray(uint64_t n){
+    return (n + STORE_ALIGN - 1) & ~(uint64_t) (STORE_ALIGN - 1);
+}
+
+/* Place an array of bytes at the end of the store being laid out */
+static uint64_t placeArray(uint64_t *size, uint64_t bytes){
+    uint64_t offset = alignArray(*size);
+    *size = offset + bytes;
+    return offset;
+}
+
+/* Write a store whose records are all in its columns */
+static int writeColumns(struct recordStore *s, FILE *f){
+    uint64_t count = s->count;
+    struct storeFileHeader h;
+    memset(&h, 0, sizeof(h));
+    h.count = s->count;
+    h.fieldCount = STORE_NUM_FIELDS;
+    h.exceptionCount = s->exceptionCount;
+
+    /* Lay out every array, so the header can be written first. */
+    uint64_t size = sizeof(h);
+    char *values[STORE_NUM_FIELDS] = {NULL};
+    for(int i = 0; i < STORE_NUM_FIELDS; i++){
+        struct storeFileColumn *fc = &h.columns[i];
+        struct storeColumn *c = &s->columns[i];
+        fc->kind = columnKinds[i];
+        switch(columnKinds[i]){
+            case COLUMN_STRING:
+                fc->first = placeArray(&size, count * sizeof(uint32_t));
+                fc->secondBytes = count * sizeof(uint32_t);
+                break;
+            case COLUMN_CODED:
+                /* The distinct values, each NUL terminated in code order. */
+                fc->valueCount = columnValueCount(c->dict);
+                size_t length;
+                for(int code = 0; code < (int) fc->valueCount; code++){
+                    columnDecode(c->dict, code, &length);
+                    fc->secondBytes += length + 1;
+                }
+                values[i] = malloc(fc->secondBytes + 1);
+                assert(values[i]);
+                char *v = values[i];
+                for(int code = 0; code < (int) fc->valueCount; code++){
+                    const char *value = columnDecode(c->dict, code, &length);
+                    memcpy(v, value, length + 1);
+                    v += length + 1;
+                }
+                fc->first = placeArray(&size, count * sizeof(columnCode));
+                break;
+            case COLUMN_INT:
+                fc->first = placeArray(&size, count * sizeof(int32_t));
+                break;
+            case COLUMN_NUMBER:
+                fc->first = placeArray(&size, count * sizeof(double));
+                fc->secondBytes = count * sizeof(uint8_t);
+                break;
+            case COLUMN_DOUBLE:
+                fc->first = placeArray(&size, count * sizeof(double));
+                break;
+        }
+        if(fc->secondBytes > 0){
+            fc->second = placeArray(&size, fc->secondBytes);
+        }
+    }
+    h.heapBytes = s->heapUsed;
+    h.heapOffset = placeArray(&size, h.heapBytes);
+    h.exceptionsOffset = placeArray(&size,
+        (uint64_t) s->exceptionCount * sizeof(struct storeException));
+    h.size = alignArray(size);
+
+    uint64_t pos = 0;
+    writeAt(f, &pos, 0, &h, sizeof(h));
+    for(int i = 0; i < STORE_NUM_FIELDS; i++){
+        struct storeFileColumn *fc = &h.columns[i];
+        struct storeColumn *c = &s->columns[i];
+        const void *second = NULL;
+        switch(columnKinds[i]){
+            case COLUMN_STRING:
+                writeAt(f, &pos, fc->first, c->offsets, count * sizeof(uint32_t));
+                second = c->lengths;
+                break;
+            case COLUMN_CODED:
+                writeAt(f, &pos, fc->first, c->codes, count * sizeof(columnCode));
+                second = values[i];
+                break;
+            case COLUMN_INT:
+                writeAt(f, &pos, fc->first, c->ints, count * sizeof(int32_t));
+                break;
+            case COLUMN_NUMBER:
+                writeAt(f, &pos, fc->first, c->values, count * sizeof(double));
+                second = c->formats;
+                break;
+            case COLUMN_DOUBLE:
+                writeAt(f, &pos, fc->first, c->values, count * sizeof(double));
+                break;
+        }
+        if(fc->secondBytes > 0){
+            writeAt(f, &pos, fc->second, second, fc->secondBytes);
+        }
+        free(values[i]);
+    }
+    writeAt(f, &pos, h.heapOffset, s->heap, h.heapBytes);
+    writeAt(f, &pos, h.exceptionsOffset, s->exceptions,
+        (uint64_t) s->exceptionCount * sizeof(struct storeException));
+    writeAt(f, &pos, h.size, NULL, 0);
+    return ferror(f) ? -1 : 0;
+}
+
+int storeWrite(struct recordStore *s, FILE *f){
+    if(! s->reader){
+        return writeColumns(s, f);
+    }
+    /* Only the keys of a lazy store are held, so decode the rest first. */
+    struct recordStore *decoded = newRecordStore();
+    for(recordId id = 0; id < s->count; id++){
+        storeAddRow(decoded, lazyRow(s, id));
+    }
+    int result = writeColumns(decoded, f);
+    freeRecordStore(decoded);
+    return result;
+}
+
+/* Returns the array of bytes at offset in data, or NULL if it is out of range */
+static void *mappedArray(const char *data, uint64_t size, uint64_t offset,
+    uint64_t bytes){
+    if(offset % STORE_ALIGN != 0 || offset > size || bytes > size - offset){
+        return NULL;
+    }
+    return (void *) (data + offset);
+}
+
+/* Map the columns of the store written with header h in place. Returns 0, or
+    -1 if a column is out of range or isn't the kind this build stores. */
+static int mapColumns(struct recordStore *s, const char *data,
+    const struct storeFileHeader *h){
+    uint64_t count = h->count;
+    for(int i = 0; i < STORE_NUM_FIELDS; i++){
+        const struct storeFileColumn *fc = &h->columns[i];
+        struct storeColumn *c = &s->columns[i];
+        if(fc->kind != (uint32_t) columnKinds[i]){
+            return -1;
+        }
+        switch(columnKinds[i]){
+            case COLUMN_STRING:
+                c->offsets = mappedArray(data, h->size, fc->first,
+                    count * sizeof(uint32_t));
+                c->lengths = mappedArray(data, h->size, fc->second,
+                    count * sizeof(uint32_t));
+                if(! c->offsets || ! c->lengths){
+                    return -1;
+                }
+                break;
+            case COLUMN_CODED: {
+                c->codes = mappedArray(data, h->size, fc->first,
+                    count * sizeof(columnCode));
+                const char *v = mappedArray(data, h->size, fc->second,
+                    fc->secondBytes);
+                if(! c->codes || ! v){
+                    return -1;
+                }
+                /* Encoding the values in order gives back the same codes. */
+                const char *end = v + fc->secondBytes;
+                c->dict = newColumnDict();
+                for(uint32_t code = 0; code < fc->valueCount; code++){
+                    size_t length = strnlen(v, end - v);
+                    if(v + length == end 
+                        || columnEncode(c->dict, v, length) != code){
+                        return -1;
+                    }
+                    v += length + 1;
+                }
+                break;
+            }
+            case COLUMN_INT:
+                c->ints = mappedArray(data, h->size, fc->first,
+                    count * sizeof(int32_t));
+                if(! c->ints){
+                    return -1;
+                }
+                break;
+            case COLUMN_NUMBER:
+                c->values = mappedArray(data, h->size, fc->first,
+                    count * sizeof(double));
+                c->formats = mappedArray(data, h->size, fc->second,
+                    count * sizeof(uint8_t));
+                if(! c->values || ! c->formats){
+                    return -1;
+                }
+                break;
+            case COLUMN_DOUBLE:
+                c->values = mappedArray(data, h->size, fc->first,
+                    count * sizeof(double));
+                if(! c->values){
+                    return -1;
+                }
+                break;
+        }
+    }
+    s->heap = mappedArray(data, h->size, h->heapOffset, h->heapBytes);
+    s->exceptions = mappedArray(data, h->size, h->exceptionsOffset,
+        (uint64_t) h->exceptionCount * sizeof(struct storeException));
+    if(! s->heap || ! s->exceptions){
+        return -1;
+    }
+    s->heapUsed = s->heapSpace = h->heapBytes;
+    s->exceptionCount = s->exceptionSpace = h->exceptionCount;
+    return 0;
+}
+
+struct recordStore *storeMap(const char *data, size_t size){
+    const struct storeFileHeader *h = (const struct storeFileHeader *) data;
+    if(size < sizeof(struct storeFileHeader) 
+        || h->fieldCount != STORE_NUM_FIELDS || h->size > size){
+        return NULL;
+    }
+
+    struct recordStore *s = calloc(1, sizeof(struct recordStore));
+    assert(s);
+    s->references = 1;
+    s->mapped = 1;
+    s->count = s->space = h->count;
+    if(mapColumns(s, data, h) != 0){
+        freeRecordStore(s);
+        return NULL;
+    }
+    return s;
+}
+
+void freeRecordStore(struct recordStore *s){
+    if(! s || --s->references > 0){
+        return;
+    }
+    for(int i = 0; i < STORE_NUM_FIELDS; i++){
+        struct storeColumn *c = &s->columns[i];
+        freeColumnDict(c->dict);
+        if(! s->mapped){
+            free(c->offsets);
+            free(c->lengths);
+            free(c->codes);
+            free(c->ints);
+            free(c->values);
+            free(c->formats);
+        }
+    }
+    if(! s->mapped){
+        free(s->heap);
+        free(s->exceptions);
+    }
+    free(s->retired);
+    free(s->pfiSlots);
+    if(s->reader){
+        if(s->cache){
+            for(recordId id = 0; id < s->count; id++){
+                a2_free(s->cache[id]);
+            }
+        }
+        free(s->cache);
+        a2_free(s->current);
+        free(s->rowOffsets);
+        free(s->rowLengths);
+        closeCSV(s->reader);
+    }
+    free(s);
+}
@@ -0,0 +1,161 @@
+/*
+ * Columnar Record Store Header
+ *
+ * A record store holds every record of a dataset column by column, each
+ * record being addressed by a 32-bit id handed out in insertion order.
+ * Numeric columns are parsed once, as records are added, into contiguous
+ * int32/double arrays. Low-cardinality columns are held as 16-bit column
+ * dictionary codes, and every other column as an offset and length into a
+ * single shared byte heap.
+ *
+ * A lazy store instead holds only the key column, plus where each record's
+ * raw row lies in a mapped CSV, and decodes the other fields on demand.
+ *
+ * Stores can be written into a snapshot and mapped back in from one, in
+ * which case the columns are used in place.
+ */
+
+#ifndef RECSTORE_H
+#define RECSTORE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "read.h"
+#include "a2data.h"
+
+/* Id of a record within its store */
+typedef uint32_t recordId;
+
+/* Number of fields in each record, and the field records are keyed on */
+#define STORE_NUM_FIELDS A2_NUM_FIELDS
+#define STORE_KEY_FIELD A2_KEY_FIELD
+
+/* Field identifying an address across datasets and change files (PFI) */
+#define STORE_PFI_FIELD 0
+
+/* Id standing for no record */
+#define STORE_NO_RECORD UINT32_MAX
+
+/* How a column is held */
+#define COLUMN_STRING 0  // Offset and length into the heap
+#define COLUMN_CODED 1   // Column dictionary code
+#define COLUMN_INT 2     // int32
+#define COLUMN_NUMBER 3  // double, with enough detail to recreate the text
+#define COLUMN_DOUBLE 4  // double, the text isn't kept
+#define COLUMN_KINDS 5
+
+/* Space needed for the text of a numeric field */
+#define STORE_TEXT_CHARS 64
+
+/* A store of records */
+struct recordStore;
+
+/* Returns how the given field is held, one of the COLUMN_ kinds */
+int storeColumnKind(int field);
+
+/* Returns an empty record store */
+struct recordStore *newRecordStore(void);
+
+/*
+ * Returns an empty lazy record store for rows read from the given mapped
+ * reader. The store takes ownership of the reader and closes it when freed.
+ * If cacheRows is set, decoded rows are kept for as long as the store.
+ */
+struct recordStore *newLazyRecordStore(struct csvReader *reader, int cacheRows);
+
+/* Returns non-zero if the store is lazy */
+int storeIsLazy(struct recordStore *s);
+
+/*
+ * Returns the store for another holder, such as a second dictionary over the
+ * same records. Each holder frees the store, it is only freed with the last.
+ */
+struct recordStore *storeShare(struct recordStore *s);
+
+/* Returns non-zero if the store has more than one holder */
+int storeIsShared(struct recordStore *s);
+
+/* Add the fields of a row read by reader (for a lazy store, its reader) */
+recordId storeAddFields(struct recordStore *s, struct csvReader *reader,
+                        struct csvField *fields, int fieldCount);
+
+/* Add an already decoded row, which the caller still owns */
+recordId storeAddRow(struct recordStore *s, a2_data *row);
+
+/* Returns the number of records in the store */
+uint32_t storeRecordCount(struct recordStore *s);
+
+/*
+ * Memory held by a record store, in bytes unless noted. Unused bytes have
+ * been allocated for records, text or exceptions not added yet.
+ */
+struct storeMemory {
+    uint32_t records;
+    uint32_t retired;                    // Records
+    int mapped;                          // Arrays are part of a snapshot
+    uint64_t columnBytes[COLUMN_KINDS];  // Arrays of each kind of column
+    uint64_t columnUnused;
+    uint64_t codedValues;                // Distinct values of COLUMN_CODED fields
+    uint64_t heapBytes;
+    uint64_t heapUnused;
+    uint32_t exceptions;
+    uint64_t exceptionBytes;
+    uint64_t exceptionUnused;
+    uint64_t indexBytes;                 // PFI index and retired flags
+    uint64_t lazyBytes;                  // Row positions and cache of a lazy store
+    uint64_t cachedRows;
+};
+
+/* Fill in m with the memory held by the store */
+void storeMemoryStats(struct recordStore *s, struct storeMemory *m);
+
+/*
+ * Returns the text of a field and stores its length in *length. Numeric
+ * fields are formatted into buf, which must hold STORE_TEXT_CHARS bytes, and
+ * COLUMN_DOUBLE fields come back in their shortest exact form rather than as
+ * the original text. Text from a lazy store is only valid until the next
+ * record is decoded.
+ */
+const char *storeText(struct recordStore *s, recordId id, int field,
+                      char *buf, unsigned int *length);
+
+/* Returns the key of a record, valid until the next record is added */
+const char *storeKey(struct recordStore *s, recordId id, unsigned int *length);
+
+/* Returns the value of a numeric field, 0 if it is empty */
+double storeDouble(struct recordStore *s, recordId id, int field);
+
+/*
+ * Mark a record as retired. Its id is never handed out again and its fields
+ * can still be read, but it is no longer found by PFI.
+ */
+void storeRetire(struct recordStore *s, recordId id);
+
+/* Returns non-zero if the record has been retired */
+int storeIsRetired(struct recordStore *s, recordId id);
+
+/*
+ * Returns the most recently added record with the given PFI which hasn't
+ * been retired, or STORE_NO_RECORD. The PFI index is built on first use and
+ * kept up to date as records are added and retired from then on.
+ */
+recordId storeFindPfi(struct recordStore *s, const char *pfi, size_t length);
+
+/*
+ * Write the store to f, which is positioned on an 8 byte boundary, so that
+ * it can be mapped back in with storeMap. Lazy stores are decoded first.
+ * Returns 0 on success.
+ */
+int storeWrite(struct recordStore *s, FILE *f);
+
+/*
+ * Returns a store using the size bytes of data written by storeWrite in
+ * place, or NULL if they aren't a store this build can use. data must stay
+ * mapped until the store is freed.
+ */
+struct recordStore *storeMap(const char *data, size_t size);
+
+/* Free a store and everything it holds, once its last holder frees it */
+void freeRecordStore(struct recordStore *s);
+
+#endif
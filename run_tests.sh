@@ -32,5 +32,78 @@ echo "NONEXISTENT_KEY_12345" | ./dict2 2 tests/dataset_1.csv test_nonexistent.tx
 echo "   Output saved to: test_nonexistent.txt"
 echo
 
+echo "6. Testing more than 256 empty keys with dataset_322.csv:"
+echo "   Input: tests/test322.in"
+./dict2 2 tests/dataset_322.csv test_output322.txt < tests/test322.in
+cmp -s test_output322.txt tests/test322.out && echo "   Output matches tests/test322.out" || echo "   Output differs from tests/test322.out"
+echo
+
+echo "7. Testing a change file retiring and updating empty keys with dataset_24.csv:"
+echo "   Input: tests/test24.in, changes: tests/delta24.csv"
+./dict2 2 tests/dataset_24.csv test_output24.txt --delta tests/delta24.csv < tests/test24.in
+cmp -s test_output24.txt tests/test24.out && echo "   Output matches tests/test24.out" || echo "   Output differs from tests/test24.out"
+echo
+
+echo "8. Testing the crit-bit trie finds the same records for empty keys:"
+echo "   Input: tests/test322.in, then tests/test24.in"
+./dict2 2 tests/dataset_322.csv test_output322_cb.txt --crit-bit < tests/test322.in
+cmp -s test_output322_cb.txt tests/test322.out && echo "   Output matches tests/test322.out" || echo "   Output differs from tests/test322.out"
+./dict2 2 tests/dataset_24.csv test_output24_cb.txt --delta tests/delta24.csv --crit-bit < tests/test24.in
+cmp -s test_output24_cb.txt tests/test24.out && echo "   Output matches tests/test24.out" || echo "   Output differs from tests/test24.out"
+echo
+
+echo "9. Testing a change file which shrinks wide nodes, re-merges chains and moves records to other keys with dataset_25.csv:"
+echo "   Input: tests/test25.in, changes: tests/delta25.csv"
+./dict2 2 tests/dataset_25.csv test_output25.txt --delta tests/delta25.csv < tests/test25.in
+cmp -s test_output25.txt tests/test25.out && echo "   Output matches tests/test25.out" || echo "   Output differs from tests/test25.out"
+echo
+
+echo "10. Testing a snapshot saved from dataset_1067.csv and loaded back:"
+echo "   Input: tests/test1067.in"
+./dict2 2 tests/dataset_1067.csv test_output1067.txt --save-snapshot test1067.snap < tests/test1067.in
+cmp -s test_output1067.txt tests/test1067.out && echo "   Output matches tests/test1067.out" || echo "   Output differs from tests/test1067.out"
+./dict2 2 test1067.snap test_output1067_snap.txt < tests/test1067.in
+cmp -s test_output1067_snap.txt tests/test1067.out && echo "   Output matches tests/test1067.out" || echo "   Output differs from tests/test1067.out"
+echo
+
+echo "11. Testing a trie frozen after building it from dataset_1067.csv:"
+echo "   Input: tests/test1067.in"
+./dict2 2 tests/dataset_1067.csv test_output1067_freeze.txt --freeze < tests/test1067.in
+cmp -s test_output1067_freeze.txt tests/test1067.out && echo "   Output matches tests/test1067.out" || echo "   Output differs from tests/test1067.out"
+echo
+
+echo "12. Testing lazily decoded records from dataset_1067.csv, with and without a row cache:"
+echo "   Input: tests/test1067.in"
+./dict2 2 tests/dataset_1067.csv test_output1067_lazy.txt --lazy < tests/test1067.in
+cmp -s test_output1067_lazy.txt tests/test1067.out && echo "   Output matches tests/test1067.out" || echo "   Output differs from tests/test1067.out"
+./dict2 2 tests/dataset_1067.csv test_output1067_cache.txt --lazy --row-cache < tests/test1067.in
+cmp -s test_output1067_cache.txt tests/test1067.out && echo "   Output matches tests/test1067.out" || echo "   Output differs from tests/test1067.out"
+echo
+
+echo "13. Testing a gzip compressed dataset_1067.csv:"
+echo "   Input: tests/test1067.in"
+./dict2 2 tests/dataset_1067.csv.gz test_output1067_gz.txt < tests/test1067.in
+cmp -s test_output1067_gz.txt tests/test1067.out && echo "   Output matches tests/test1067.out" || echo "   Output differs from tests/test1067.out"
+echo
+
+echo "14. Testing a trie built from dataset_12000.csv.gz on several threads, with enough keys to split:"
+echo "   Input: tests/test12000.in"
+./dict2 2 tests/dataset_12000.csv.gz test_output12000_threads.txt --threads 4 < tests/test12000.in
+cmp -s test_output12000_threads.txt tests/test12000.out && echo "   Output matches tests/test12000.out" || echo "   Output differs from tests/test12000.out"
+echo
+
+echo "15. Testing a trie sharing the records of a dictionary of dataset_1067.csv (make tests/shared_store first):"
+echo "   Input: tests/test1067.in, refused changes: tests/delta24.csv"
+./tests/shared_store tests/dataset_1067.csv tests/delta24.csv test_output1067_dict.txt test_output1067_shared.txt < tests/test1067.in > /dev/null && echo "   Changes to the shared records were refused" || echo "   Changes to the shared records were not refused"
+cmp -s test_output1067_dict.txt tests/test1067.out && echo "   Output matches tests/test1067.out" || echo "   Output differs from tests/test1067.out"
+cmp -s test_output1067_shared.txt tests/test1067.out && echo "   Output matches tests/test1067.out" || echo "   Output differs from tests/test1067.out"
+echo
+
+echo "16. Testing a truncated gzip compressed dataset is reported:"
+echo "   Input: tests/test1067.in"
+./dict2 2 tests/truncated_1067.csv.gz test_output_truncated.txt < tests/test1067.in > /dev/null && echo "   Truncated dataset was not reported" || echo "   Truncated dataset was reported"
+./dict2 2 tests/truncated_1067.csv.gz test_output_truncated.txt --threads 4 < tests/test1067.in > /dev/null && echo "   Truncated dataset was not reported" || echo "   Truncated dataset was reported"
+echo
+
 echo "=== All tests completed ==="
 echo "Check the output files for detailed results."
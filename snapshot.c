@@ -0,0 +1,376 @@
+/*
+ * Patricia Trie snapshot implementation
+ * Saves a built trie as flat arrays and searches them in place once mapped
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+#include "editdist.h"
+
+#define BYTE_ORDER_MARK 0x01020304u
+#define SECTION_ALIGN 8
+#define INIT_NODES 64
+
+/* Round n up to the next section boundary */
+static uint64_t align_section(uint64_t n){
+    return (n + SECTION_ALIGN - 1) & ~(uint64_t) (SECTION_ALIGN - 1);
+}
+
+/* Number of children a node has in the snapshot, where the leaves of the
+    empty key follow the root's children */
+static uint32_t child_count(const ptree_t *t, const pt_node_t *node){
+    return node->child_count + (node == t->root ? t->empty_count : 0);
+}
+
+/*
+ * List the nodes of the trie in level order, so the children of each node
+ * end up next to each other
+ */
+static pt_node_t **level_order(ptree_t *t, size_t *count){
+    size_t space = INIT_NODES;
+    size_t n = 0;
+    pt_node_t **order = malloc(sizeof(*order) * space);
+    assert(order);
+    order[n++] = t->root;
+    for(size_t i = 0; i < n; i++){
+        pt_node_t *node = order[i];
+        if(n + child_count(t, node) > space){
+            while(n + child_count(t, node) > space){
+                space *= 2;
+            }
+            order = realloc(order, sizeof(*order) * space);
+            assert(order);
+        }
+        for(int c = 0; c < node->child_count; c++){
+            order[n++] = pt_child(t, node, c);
+        }
+        if(node == t->root){
+            for(uint32_t e = 0; e < t->empty_count; e++){
+                order[n++] = pt_node(t, t->empty_keys[e]);
+            }
+        }
+    }
+    *count = n;
+    return order;
+}
+
+/* Point a snapshot at the sections laid out after the header at map */
+static void set_sections(pt_snapshot_t *s, void *map){
+    const pt_snapshot_header_t *h = (const pt_snapshot_header_t *) map;
+    s->map = map;
+    s->nodes = (const pt_snapshot_node_t *) ((const char *) map + h->nodes_offset);
+    s->node_count = h->node_count;
+    s->labels = (const char *) map + h->labels_offset;
+    s->records = (const recordId *) ((const char *) map + h->records_offset);
+    s->record_count = h->record_count;
+}
+
+pt_snapshot_t *pt_freeze(ptree_t *t, struct recordStore *store){
+    size_t nodeCount;
+    pt_node_t **order = level_order(t, &nodeCount);
+
+    /* The sections are laid out as they are saved, up to the store. */
+    uint64_t labelBytes = 0;
+    uint64_t recordCount = 0;
+    for(size_t i = 0; i < nodeCount; i++){
+        if(order[i]->records.count == 0){
+            labelBytes += order[i]->label_len + 1;
+        }
+        recordCount += order[i]->records.count;
+    }
+    assert(nodeCount < PT_SNAPSHOT_NONE && recordCount < UINT32_MAX);
+    assert(labelBytes <= UINT32_MAX);
+
+    pt_snapshot_header_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, PT_SNAPSHOT_MAGIC, PT_SNAPSHOT_MAGIC_LEN);
+    h.version = PT_SNAPSHOT_VERSION;
+    h.byte_order = BYTE_ORDER_MARK;
+    h.node_count = (uint32_t) nodeCount;
+    h.record_count = (uint32_t) recordCount;
+    h.label_bytes = labelBytes;
+    h.nodes_offset = align_section(sizeof(h));
+    h.labels_offset = align_section(h.nodes_offset
+        + nodeCount * sizeof(pt_snapshot_node_t));
+    h.records_offset = align_section(h.labels_offset + labelBytes);
+    h.store_offset = align_section(h.records_offset
+        + recordCount * sizeof(recordId));
+
+    char *map = calloc(1, h.store_offset);
+    assert(map);
+    memcpy(map, &h, sizeof(h));
+    pt_snapshot_node_t *nodes = (pt_snapshot_node_t *) (map + h.nodes_offset);
+    char *labels = map + h.labels_offset;
+    recordId *records = (recordId *) (map + h.records_offset);
+
+    /* Nodes, with children and records numbered in the same level order. */
+    uint32_t labelOffset = 0;
+    uint32_t nextChild = 1;
+    uint32_t nextRecord = 0;
+    for(size_t i = 0; i < nodeCount; i++){
+        const pt_node_t *node = order[i];
+        pt_snapshot_node_t *n = &nodes[i];
+        n->label_length = node->label_len;
+        n->first = node->label_len ? pt_label(t, node)[0] : '\0';
+        if(node->records.count == 0){
+            /* The root has no label, nor key to find one in. */
+            n->label_offset = labelOffset;
+            if(node->label_len > 0){
+                memcpy(labels + labelOffset, pt_label(t, node), node->label_len);
+            }
+            labelOffset += node->label_len + 1;
+        }
+        n->first_child = nextChild;
+        n->first_record = nextRecord;
+        memcpy(records + nextRecord, pt_record_ids(&node->records),
+            sizeof(recordId) * node->records.count);
+        nextChild += child_count(t, node);
+        nextRecord += node->records.count;
+    }
+    free(order);
+
+    pt_snapshot_t *s = malloc(sizeof(*s));
+    assert(s);
+    set_sections(s, map);
+    s->map_size = h.store_offset;
+    s->frozen = true;
+    s->store = storeShare(store);
+    return s;
+}
+
+int pt_snapshot_save(ptree_t *t, struct recordStore *store, const char *filename){
+    FILE *f = fopen(filename, "wb");
+    if(!f){
+        return -1;
+    }
+    /* The header is rewritten once the store has been written and sized. */
+    pt_snapshot_t *s = pt_freeze(t, store);
+    pt_snapshot_header_t h = *(const pt_snapshot_header_t *) s->map;
+    fwrite(s->map, 1, s->map_size, f);
+    pt_snapshot_close(s);
+
+    int failed = storeWrite(store, f) != 0;
+    long end = ftell(f);
+    failed = failed || end < 0;
+    if(!failed){
+        h.file_size = (uint64_t) end;
+        h.store_bytes = h.file_size - h.store_offset;
+        failed = fseek(f, 0, SEEK_SET) != 0 || fwrite(&h, sizeof(h), 1, f) != 1;
+    }
+
+    failed = failed || ferror(f);
+    if(fclose(f) != 0 || failed){
+        return -1;
+    }
+    return 0;
+}
+
+/* Returns whether bytes at offset fit before end, without overflowing */
+static bool section_fits(uint64_t offset, uint64_t bytes, uint64_t end){
+    return offset % 8 == 0 && offset <= end && bytes <= end - offset;
+}
+
+/* Returns whether the header describes a snapshot of size bytes in this
+    version of the layout, whose sections are in order and in the file */
+static bool header_valid(const pt_snapshot_header_t *h, uint64_t size){
+    return h->version == PT_SNAPSHOT_VERSION
+        && h->byte_order == BYTE_ORDER_MARK
+        && h->file_size == size
+        && h->node_count > 0
+        && h->nodes_offset >= sizeof(pt_snapshot_header_t)
+        && section_fits(h->nodes_offset,
+            (uint64_t) h->node_count * sizeof(pt_snapshot_node_t), h->labels_offset)
+        && section_fits(h->labels_offset, h->label_bytes, h->records_offset)
+        && section_fits(h->records_offset,
+            (uint64_t) h->record_count * sizeof(recordId), h->store_offset)
+        && section_fits(h->store_offset, h->store_bytes, h->file_size);
+}
+
+pt_snapshot_t *pt_snapshot_open(const char *filename, int *version){
+    *version = -1;
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0){
+        return NULL;
+    }
+    /* Only regular files can be snapshots, and peeking at a pipe would
+        consume the data. */
+    struct stat st;
+    pt_snapshot_header_t h;
+    memset(&h, 0, sizeof(h));
+    ssize_t got = 0;
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)
+        || (got = pread(fd, &h, sizeof(h), 0)) < PT_SNAPSHOT_MAGIC_LEN
+        || memcmp(h.magic, PT_SNAPSHOT_MAGIC, PT_SNAPSHOT_MAGIC_LEN) != 0){
+        close(fd);
+        return NULL;
+    }
+    /* From here on it is a snapshot, which may not be one this can read. */
+    *version = h.version <= INT32_MAX ? (int) h.version : INT32_MAX;
+    if((size_t) got < sizeof(h) || !header_valid(&h, (uint64_t) st.st_size)){
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED){
+        return NULL;
+    }
+    struct recordStore *store = storeMap((const char *) map + h.store_offset,
+        h.store_bytes);
+    if(! store){
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    pt_snapshot_t *s = malloc(sizeof(*s));
+    assert(s);
+    set_sections(s, map);
+    s->map_size = st.st_size;
+    s->frozen = false;
+    s->store = store;
+    return s;
+}
+
+void pt_snapshot_close(pt_snapshot_t *s){
+    if(!s) return;
+    freeRecordStore(s->store);
+    if(s->frozen){
+        free(s->map);
+    } else {
+        munmap(s->map, s->map_size);
+    }
+    free(s);
+}
+
+/* Returns the label of a node, which is the end of the key of a node with records */
+static const char *node_label(const pt_snapshot_t *s, uint32_t i){
+    const pt_snapshot_node_t *n = &s->nodes[i];
+    if(pt_snapshot_record_count(s, i) == 0){
+        return s->labels + n->label_offset;
+    }
+    unsigned int keyLength;
+    const char *key = storeKey(s->store, s->records[n->first_record], &keyLength);
+    return key + keyLength - n->label_length;
+}
+
+/* Find a child node whose label starts with the same character as key */
+static uint32_t find_candidate_child(const pt_snapshot_t *s, uint32_t parent,
+                                     const char *key){
+    uint32_t first = s->nodes[parent].first_child;
+    uint32_t end = first + pt_snapshot_child_count(s, parent);
+    for(uint32_t i = first; i < end; i++){
+        if(s->nodes[i].first == key[0])
+            return i;
+    }
+    return PT_SNAPSHOT_NONE;
+}
+
+uint32_t pt_snapshot_search_with_mismatch(const pt_snapshot_t *s, const char *key,
+                                          bool *exact_terminal){
+    if(exact_terminal) *exact_terminal = false;
+
+    uint32_t cur = 0;
+    const char *rest = key;
+    size_t restLen = strlen(key);
+    g_metrics.nodeCount = 0ULL;
+
+    while(1){
+        g_metrics.nodeCount++;  // Count each node visit
+
+        uint32_t child = find_candidate_child(s, cur, rest);
+        if(child == PT_SNAPSHOT_NONE) return cur;
+
+        const pt_snapshot_node_t *n = &s->nodes[child];
+        int lcp = pt_lcp_bits(rest, restLen, node_label(s, child), n->label_length);
+
+        // Mismatch within the edge label
+        if(lcp < (int)n->label_length) return child;
+
+        rest += lcp;
+        restLen -= lcp;
+        cur = child;
+
+        if(*rest == '\0'){
+            if(pt_snapshot_record_count(s, child) > 0 && exact_terminal) *exact_terminal = true;
+            return cur;
+        }
+    }
+}
+
+/* State of a similarity search */
+typedef struct {
+    const pt_snapshot_t *s;
+    const char *query;
+    int query_len;
+    int best_dist;
+    const char *best_key;       // Points into the key of its record
+    size_t best_len;
+    uint32_t best_node;
+} snap_sim_t;
+
+/* Compare two keys of the given lengths in the same way as strcmp */
+static int compare_keys(const char *a, size_t a_len, const char *b, size_t b_len){
+    int c = memcmp(a, b, a_len < b_len ? a_len : b_len);
+    if(c != 0) return c;
+    return (a_len > b_len) - (a_len < b_len);
+}
+
+/* Visit every node under index, whose key so far is prefix_len long. The key
+    of a node with records is read from the end of theirs */
+static void similar_visit(snap_sim_t *sim, uint32_t index, size_t prefix_len){
+    const pt_snapshot_node_t *n = &sim->s->nodes[index];
+    g_metrics.nodeCount++;
+
+    size_t len = prefix_len + n->label_length;
+    if(pt_snapshot_record_count(sim->s, index) > 0){
+        g_metrics.stringCount++;
+        unsigned int keyLength;
+        const char *key = storeKey(sim->s->store, sim->s->records[n->first_record],
+            &keyLength);
+        key += keyLength - len;
+        int d = editDistance((char*)sim->query, (char*)key, sim->query_len, (int)len);
+        if(!sim->best_key || d < sim->best_dist ||
+           (d == sim->best_dist && compare_keys(key, len, sim->best_key, sim->best_len) < 0)){
+            sim->best_key = key;
+            sim->best_len = len;
+            sim->best_dist = d;
+            sim->best_node = index;
+        }
+    }
+
+    uint32_t end = n->first_child + pt_snapshot_child_count(sim->s, index);
+    for(uint32_t i = n->first_child; i < end; i++){
+        similar_visit(sim, i, len);
+    }
+}
+
+uint32_t pt_snapshot_search_similar_under(const pt_snapshot_t *s, uint32_t node,
+                                          const char *query, char **best_key_out){
+    if(node == PT_SNAPSHOT_NONE) return PT_SNAPSHOT_NONE;
+
+    snap_sim_t sim = {0};
+    sim.s = s;
+    sim.query = query;
+    sim.query_len = (int)strlen(query);
+    sim.best_dist = 0x3f3f3f3f;  // Large initial distance
+    sim.best_node = PT_SNAPSHOT_NONE;
+
+    similar_visit(&sim, node, 0);
+
+    if(best_key_out){
+        *best_key_out = NULL;
+        if(sim.best_key){
+            *best_key_out = strndup(sim.best_key, sim.best_len);
+            assert(*best_key_out);
+        }
+    }
+
+    return sim.best_node;
+}
@@ -0,0 +1,135 @@
+/*
+ * Patricia Trie Snapshot Header
+ *
+ * This header declares a binary snapshot format for a built Patricia Trie.
+ * A snapshot stores the trie as flat arrays (nodes in level order, packed
+ * labels and the ids of each key's records) followed by the columns of the
+ * record store, all addressed purely by offsets, so it can be mapped straight
+ * into memory and searched in place without rebuilding the trie or parsing
+ * the CSV again.
+ *
+ * A trie which won't change again can also be frozen into the same arrays in
+ * memory, which take around half the memory of its nodes. Only the labels of
+ * nodes without records are packed, the label of a node with records is the
+ * end of their key.
+ *
+ * File layout, every section starting on an 8 byte boundary:
+ *   header | nodes | labels | record ids | record store
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "patricia.h"
+#include "recstore.h"
+
+/* Bytes identifying a snapshot file, and the version of the layout */
+#define PT_SNAPSHOT_MAGIC "PTSNAP\r\n"
+#define PT_SNAPSHOT_MAGIC_LEN 8
+#define PT_SNAPSHOT_VERSION 3
+
+/* Index used when there is no node */
+#define PT_SNAPSHOT_NONE UINT32_MAX
+
+/*
+ * Snapshot file header
+ * Offsets are from the start of the file
+ */
+typedef struct pt_snapshot_header {
+    char magic[PT_SNAPSHOT_MAGIC_LEN];  // PT_SNAPSHOT_MAGIC
+    uint32_t version;                   // PT_SNAPSHOT_VERSION
+    uint32_t byte_order;                // 0x01020304 as written by the saving machine
+    uint32_t node_count;
+    uint32_t record_count;
+    uint64_t label_bytes;
+    uint64_t store_bytes;
+    uint64_t nodes_offset;
+    uint64_t labels_offset;
+    uint64_t records_offset;
+    uint64_t store_offset;
+    uint64_t file_size;
+} pt_snapshot_header_t;
+
+/*
+ * Snapshot trie node
+ * Nodes are stored in level order, so the children of a node are adjacent
+ * and the root is node 0, and the children and records of each node end
+ * where the next node's start. A node is terminal when it has records.
+ */
+typedef struct pt_snapshot_node {
+    uint32_t label_offset;  // Offset of the NUL terminated label in the labels, if no records
+    uint32_t first_child;   // Index of the first child node
+    uint32_t first_record;  // Index of the first record id of the key
+    uint16_t label_length;  // Length of the label in characters
+    char first;             // First character of the label, '\0' if empty
+    uint8_t unused;
+} pt_snapshot_node_t;
+
+/* A snapshot mapped into memory, or a frozen trie */
+typedef struct pt_snapshot {
+    void *map;                              // Mapping of the whole file, or the
+    size_t map_size;                        // frozen trie's sections
+    bool frozen;
+    const pt_snapshot_node_t *nodes;
+    uint32_t node_count;
+    const char *labels;
+    const recordId *records;                // Ids of each key's records in the store
+    uint32_t record_count;
+    struct recordStore *store;              // Records, used in place
+} pt_snapshot_t;
+
+/* Returns the number of children of a node */
+static inline uint32_t pt_snapshot_child_count(const pt_snapshot_t *s, uint32_t i){
+    uint32_t end = i + 1 < s->node_count ? s->nodes[i + 1].first_child : s->node_count;
+    return end - s->nodes[i].first_child;
+}
+
+/* Returns the number of records of a node */
+static inline uint32_t pt_snapshot_record_count(const pt_snapshot_t *s, uint32_t i){
+    uint32_t end = i + 1 < s->node_count ? s->nodes[i + 1].first_record : s->record_count;
+    return end - s->nodes[i].first_record;
+}
+
+/*
+ * Freeze a trie over the records of store into a snapshot held in memory,
+ * which holds a share of the store (see storeShare). The trie can be freed.
+ */
+pt_snapshot_t *pt_freeze(ptree_t *t, struct recordStore *store);
+
+/*
+ * Write the trie and the store its records are in to filename as a snapshot
+ * Returns 0 on success, or -1 if the file could not be written
+ */
+int pt_snapshot_save(ptree_t *t, struct recordStore *store, const char *filename);
+
+/*
+ * Map the snapshot stored in filename
+ * Returns NULL if the file is not a snapshot, so the caller can fall back to
+ * reading it as CSV, and sets *version to -1. A snapshot which is damaged or
+ * from an incompatible version is not mapped either: NULL is returned with
+ * *version set to the version in its header, or 0 if it is too short to
+ * have one.
+ */
+pt_snapshot_t *pt_snapshot_open(const char *filename, int *version);
+
+/* Unmap and free a snapshot, or free a frozen trie */
+void pt_snapshot_close(pt_snapshot_t *s);
+
+/*
+ * Search for a key in the snapshot with mismatch detection
+ * Behaves as pt_search_with_mismatch, returning the index of the node
+ */
+uint32_t pt_snapshot_search_with_mismatch(const pt_snapshot_t *s, const char *key,
+                                          bool *exact_terminal);
+
+/*
+ * Find the most similar key in the subtree rooted at the given node
+ * Behaves as pt_search_similar_under, returning the index of the node
+ * holding the best key, or PT_SNAPSHOT_NONE if the subtree has no keys
+ */
+uint32_t pt_snapshot_search_similar_under(const pt_snapshot_t *s, uint32_t node,
+                                          const char *query, char **best_key_out);
+
+#endif
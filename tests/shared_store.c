@@ -0,0 +1,124 @@
+/*
+    Checks a Patricia Trie dictionary built over a dictionary's records with
+    newPatriciaDictFromDict. Both are built over one store twice, freeing the
+    dictionary first the first time and the trie first the second, and the
+    one left is searched for every key. Changes to the shared records must
+    be refused by both.
+
+    Compile with
+        make tests/shared_store
+
+    Run with
+        ./tests/shared_store <input dataset> <change file> <dict output>
+            <trie output> < <keys file>
+    Where both outputs should match dict1's for the same keys.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "dictionary.h"
+
+#define NUM_FIELDS 35
+#define INIT_KEYS 16
+
+/* Read every key from f, returns how many were read. */
+static int readKeys(FILE *f, char ***keys){
+    int count = 0;
+    int space = INIT_KEYS;
+    *keys = (char **) malloc(sizeof(char *) * space);
+    assert(*keys);
+    char *key;
+    while((key = getQuery(f))){
+        if(count == space){
+            space *= 2;
+            *keys = (char **) realloc(*keys, sizeof(char *) * space);
+            assert(*keys);
+        }
+        (*keys)[count++] = key;
+    }
+    return count;
+}
+
+/* Returns a dictionary of the records in the given CSV. */
+static struct dictionary *readDict(const char *filename){
+    struct csvReader *reader = openCSV(filename);
+    if(! reader){
+        fprintf(stderr, "Could not open %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    struct dictionary *dict = newDict();
+    struct csvField fields[NUM_FIELDS];
+    int fieldCount;
+    while((fieldCount = nextCSVRow(reader, fields, NUM_FIELDS)) > 0){
+        insertRecordFields(dict, reader, fields, fieldCount);
+    }
+    if(fieldCount < 0){
+        fprintf(stderr, "Could not read %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    closeCSV(reader);
+    return dict;
+}
+
+/* Open the given output file. */
+static FILE *openOutput(const char *filename){
+    FILE *f = fopen(filename, "w");
+    if(! f){
+        fprintf(stderr, "Could not open %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    return f;
+}
+
+/* Build a dictionary and a trie over the same records and check neither
+    takes changes, then free one and search the other. */
+static void checkShared(const char *datasetName, const char *deltaName,
+    const char *outputName, int dictFirst, char **keys, int keyCount){
+    struct dictionary *dict = readDict(datasetName);
+    struct patriciaDict *trie = newPatriciaDictFromDict(dict);
+    if(applyDelta(dict, deltaName) >= 0 || applyPatriciaDelta(trie, deltaName) >= 0){
+        fprintf(stderr, "Changes from %s were applied to shared records\n",
+            deltaName);
+        exit(EXIT_FAILURE);
+    }
+
+    FILE *outputFile = openOutput(outputName);
+    if(dictFirst){
+        freeDict(dict);
+        for(int i = 0; i < keyCount; i++){
+            struct queryResult *r = lookupPatriciaRecord(trie, keys[i]);
+            printQueryResult(r, stdout, outputFile, LOOKUPSTAGE);
+            freeQueryResult(r);
+        }
+        freePatriciaDict(trie);
+    } else {
+        freePatriciaDict(trie);
+        for(int i = 0; i < keyCount; i++){
+            struct queryResult *r = lookupRecord(dict, keys[i]);
+            printQueryResult(r, stdout, outputFile, LOOKUPSTAGE);
+            freeQueryResult(r);
+        }
+        freeDict(dict);
+    }
+    fclose(outputFile);
+}
+
+int main(int argc, char **argv){
+    if(argc != 5){
+        fprintf(stderr, "Usage: %s <input dataset> <change file> "
+            "<dict output> <trie output> < <keys file>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    char **keys;
+    int keyCount = readKeys(stdin, &keys);
+
+    checkShared(argv[1], argv[2], argv[4], 1, keys, keyCount);
+    checkShared(argv[1], argv[2], argv[3], 0, keys, keyCount);
+
+    for(int i = 0; i < keyCount; i++){
+        free(keys[i]);
+    }
+    free(keys);
+    freeFieldEncodings();
+    return EXIT_SUCCESS;
+}